@@ -1,5 +1,7 @@
 #include <cstdlib>
 #include <string>
+#include <iostream>
+#include <sstream>
 #include <fstream>
 #include <algorithm>
 #include <cmath>
@@ -9,10 +11,7 @@
 
 #include <mapreduce/mapreduce.hpp>
 
-struct InputData {
-    std::unordered_map<std::string, size_t> *counts;
-    size_t totalSentenceCount;
-};
+const std::string WordCountsTable = "word_counts";
 
 std::string transformToLower(const std::string &s) {
     std::string result(s.length(), '\0');
@@ -84,13 +83,14 @@ public:
         for (size_t i = 0; i < values.size(); ++i) {
             occurences += atoi(values[i].c_str());
         }
-        InputData *data = (InputData *)getUserData();
+        size_t totalSentenceCount = *(size_t *)getUserData();
+        const MapReduce::BroadcastTable<size_t> &counts = getBroadcast<size_t>(WordCountsTable);
         std::stringstream ss(key); 
         std::string first, second;
         ss >> first; ss >> second;
-        double jointProb = (float) occurences / data->totalSentenceCount;
-        double firstProb = (float)((*data->counts)[first]) / data->totalSentenceCount;
-        double secondProb = (float)((*data->counts)[second]) / data->totalSentenceCount;
+        double jointProb = (float) occurences / totalSentenceCount;
+        double firstProb = (float)(getCount(counts, first)) / totalSentenceCount;
+        double secondProb = (float)(getCount(counts, second)) / totalSentenceCount;
         double pmi = std::log10(jointProb / (firstProb * secondProb));
         double npmi = pmi / (-log10(jointProb));
         emit(key, std::to_string(npmi));
@@ -99,6 +99,12 @@ public:
     static std::string getName() {
         return "PMIReducer";
     }
+
+private:
+    static size_t getCount(const MapReduce::BroadcastTable<size_t> &counts, const std::string &word) {
+        const size_t *count = counts.find(word);
+        return count ? *count : 0;
+    }
 };
 
 REGISTER_REDUCER(PMIReducer)
@@ -153,17 +159,15 @@ int main(int argc, char *argv[]) {
     // Count NPMI
     std::unordered_map<std::string, size_t> countsMap;
     convertToUnorderedSet(results, countsMap);
-    InputData data;
-    data.counts = &countsMap;
-    data.totalSentenceCount = count;
+    specification.addBroadcast<size_t>(WordCountsTable, countsMap.begin(), countsMap.end());
 
     specification.setMapper(PMIMapper::getName());
     specification.setReducer(PMIReducer::getName());
-    specification.setUserData(&data);
-    MapReduce::RunComputation(specification, results);
-    std::sort(results.begin(), results.end(), [] (const MapReduce::Record &a, const MapReduce::Record &b) {
+    specification.setUserData(&count);
+    specification.setOutputComparer([] (const MapReduce::Record &a, const MapReduce::Record &b) {
         return a.getValue() > b.getValue();
     });
+    MapReduce::RunComputation(specification, results);
     writeOutput(results);
     return 0;
 }
@@ -3,6 +3,8 @@
 #include <vector>
 #include <functional>
 
+#include "broadcast.hpp"
+
 namespace MapReduce {
 
 /* Base classes (record, mapper, reducer, partitioner) */
@@ -32,19 +34,36 @@ private:
 
 using RecordVector = std::vector<Record>;
 
+// Receives intermediate records instead of mapper's own buffer (pipelined mode)
+class IntermediateSink {
+public:
+    virtual void emit(const std::string &key, const std::string &value) = 0;
+    virtual ~IntermediateSink() { }
+};
+
 class MapJob;
+class ShuffleJob;
 class Mapper {
 public:
     virtual void operator() (const std::string &key, const std::string &value)  = 0;
     virtual ~Mapper() { } 
 
     void emitIntermediate(const std::string &key, const std::string &value) {
+        if (sink_) {
+            sink_->emit(key, value);
+            return;
+        }
         intermediate_.push_back(Record(key, value));
     }
     
     void *getUserData() const { return userData_; }
     size_t getSize() const { return intermediate_.size(); }
 
+    template <class V>
+    const BroadcastTable<V> &getBroadcast(const std::string &name) const {
+        return findBroadcast<V>(broadcasts_, name);
+    }
+
     using ConstIterator = typename RecordVector::const_iterator;
     
     ConstIterator cbegin() const { return intermediate_.cbegin(); }
@@ -52,12 +71,19 @@ public:
     
 private:
     friend class MapJob;
+    friend class ShuffleJob;
     void setUserData(void *data) { userData_ = data; }
+    void setBroadcasts(const BroadcastMap *broadcasts) { broadcasts_ = broadcasts; }
+    void setSink(IntermediateSink *sink) { sink_ = sink; }
     void *userData_;
+    const BroadcastMap *broadcasts_;
+    IntermediateSink *sink_;
     RecordVector intermediate_;
+    // Placement mode: partition p is [partitionBounds_[p], partitionBounds_[p + 1])
+    std::vector<size_t> partitionBounds_;
 };
 
-class ReduceJob;
+template <class Input> class ReduceJob;
 class Reducer {
 public:
     typedef std::vector<std::string> ValueVector;
@@ -71,15 +97,22 @@ public:
     void *getUserData() const { return userData_; }
     size_t getSize() const { return results_.size(); }
 
+    template <class V>
+    const BroadcastTable<V> &getBroadcast(const std::string &name) const {
+        return findBroadcast<V>(broadcasts_, name);
+    }
+
     using ConstIterator = typename RecordVector::const_iterator;
     
     ConstIterator cbegin() const { return results_.cbegin(); }
     ConstIterator cend() const { return results_.cend(); }
 
 private:
-    friend class ReduceJob;
+    template <class Input> friend class ReduceJob;
     void setUserData(void *data) { userData_ = data; }
+    void setBroadcasts(const BroadcastMap *broadcasts) { broadcasts_ = broadcasts; }
     void *userData_;
+    const BroadcastMap *broadcasts_;
     RecordVector results_;
 };
 
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace MapReduce {
+
+/* Read-only side inputs shared by all map and reduce tasks */
+
+class BroadcastBase {
+public:
+    virtual size_t size() const = 0;
+    virtual ~BroadcastBase() { }
+};
+
+// Immutable open addressing hash table. Keys, values and hashes are stored in
+// flat arrays, the slot array only keeps indices into them. The table is never
+// modified after construction, so it can be read from any number of threads.
+template <class V>
+class BroadcastTable: public BroadcastBase {
+public:
+    template <class Iterator>
+    BroadcastTable(Iterator begin, Iterator end) {
+        for (auto it = begin; it != end; ++it) {
+            keys_.push_back(it->first);
+            values_.push_back(it->second);
+        }
+        build();
+    }
+
+    virtual size_t size() const { return keys_.size(); }
+
+    // Returns NULL if key is not present
+    const V *find(const std::string &key) const {
+        if (keys_.empty()) {
+            return NULL;
+        }
+        size_t hash = hasher_(key);
+        for (size_t pos = hash & mask_; slots_[pos] != EmptySlot; pos = (pos + 1) & mask_) {
+            size_t index = slots_[pos];
+            if (hashes_[index] == hash && keys_[index] == key) {
+                return &values_[index];
+            }
+        }
+        return NULL;
+    }
+
+    bool contains(const std::string &key) const { return find(key) != NULL; }
+
+    const V &get(const std::string &key) const {
+        const V *value = find(key);
+        if (!value) {
+            throw std::out_of_range("Key not found (BroadcastTable::get)");
+        }
+        return *value;
+    }
+
+    using ConstKeyIterator = typename std::vector<std::string>::const_iterator;
+
+    ConstKeyIterator cbegin() const { return keys_.cbegin(); }
+    ConstKeyIterator cend() const { return keys_.cend(); }
+
+private:
+    static const size_t EmptySlot = static_cast<size_t>(-1);
+
+    void build() {
+        size_t capacity = 1;
+        while (capacity < 2 * keys_.size()) {
+            capacity <<= 1;
+        }
+        mask_ = capacity - 1;
+        slots_.assign(capacity, EmptySlot);
+        hashes_.resize(keys_.size());
+        for (size_t index = 0; index < keys_.size(); ++index) {
+            size_t hash = hasher_(keys_[index]);
+            hashes_[index] = hash;
+            size_t pos = hash & mask_;
+            while (slots_[pos] != EmptySlot) {
+                if (hashes_[slots_[pos]] == hash && keys_[slots_[pos]] == keys_[index]) {
+                    throw std::invalid_argument("Duplicate key (BroadcastTable::BroadcastTable)");
+                }
+                pos = (pos + 1) & mask_;
+            }
+            slots_[pos] = index;
+        }
+    }
+
+    std::hash<std::string> hasher_;
+    std::vector<std::string> keys_;
+    std::vector<V> values_;
+    std::vector<size_t> hashes_;
+    std::vector<size_t> slots_;
+    size_t mask_;
+};
+
+template <class V>
+const size_t BroadcastTable<V>::EmptySlot;
+
+template <class V, class Iterator>
+std::shared_ptr<const BroadcastTable<V>> makeBroadcastTable(Iterator begin, Iterator end) {
+    return std::make_shared<const BroadcastTable<V>>(begin, end);
+}
+
+using BroadcastMap = std::unordered_map<std::string, std::shared_ptr<const BroadcastBase>>;
+
+template <class V>
+const BroadcastTable<V> &findBroadcast(const BroadcastMap *broadcasts, const std::string &name) {
+    if (!broadcasts) {
+        throw std::runtime_error("Broadcast inputs are not available (MapReduce::findBroadcast)");
+    }
+    auto it = broadcasts->find(name);
+    if (it == broadcasts->end()) {
+        throw std::runtime_error("Broadcast input not found (MapReduce::findBroadcast)");
+    }
+    const BroadcastTable<V> *table = dynamic_cast<const BroadcastTable<V> *>(it->second.get());
+    if (!table) {
+        throw std::runtime_error("Broadcast input has different value type (MapReduce::findBroadcast)");
+    }
+    return *table;
+}
+
+} // namespace MapReduce
@@ -5,128 +5,401 @@
 #include <memory>
 #include <algorithm>
 #include <future>
+#include <exception>
 #include <boost/thread.hpp>
 
+#include <trace.hpp>
+
 #include "base.hpp"
 #include "registerer.hpp"
 #include "specification.hpp"
 #include "sort.hpp"
+#include "pipeline.hpp"
 #include "utils.hpp"
 
 namespace MapReduce {
 
 /* MapReduce framework computation implementation */
 
+// With placement policy mappers split their output by reducer partition and
+// sort it in node-local memory, and every reducer's input is merged from
+// these runs on the reducer's node, so global sort and merge are not needed
+static bool isLocalSortEnabled(const Specification &spec) {
+    return spec.getPlacementPolicy() != PlacementPolicy::None && !spec.isMapOnly() &&
+        !spec.isPipelined();
+}
+
+// Runs the jobs of a phase on the process-wide executor, at most count of
+// them at once. With a placement policy every job gets a thread of its own
+// pinned by index, and so do blocking jobs (pipelined mappers wait for room
+// in channels), which should not hold workers shared with others
+class JobRunner {
+public:
+    JobRunner(size_t count, PlacementPolicy placement, bool blocking = false):
+        placement_(placement)
+    {
+        if (placement == PlacementPolicy::None && !blocking) {
+            arena_.reset(new TaskArena(DefaultExecutor::get(), std::max<size_t>(1, count)));
+        }
+    }
+
+    JobRunner(const JobRunner &rhs) = delete;
+    JobRunner &operator= (const JobRunner &rhs) = delete;
+
+    ~JobRunner() {
+        std::for_each(threads_.begin(), threads_.end(), std::mem_fn(&boost::thread::join));
+    }
+
+    template <class Job>
+    std::future<typename std::result_of<Job()>::type> start(Job job, size_t index) {
+        using Result = typename std::result_of<Job()>::type;
+        if (arena_) {
+            return arena_->addTask(std::move(job));
+        }
+        PlacementPolicy placement = placement_;
+        std::packaged_task<Result()> task([job, index, placement] () -> Result {
+            pinCurrentThread(index, placement);
+            return job();
+        });
+        std::future<Result> result = task.get_future();
+        threads_.emplace_back(std::move(task));
+        return result;
+    }
+
+    // Result of a job, called from a worker runs other tasks meanwhile
+    template <class T>
+    T get(std::future<T> &future) {
+        if (arena_) {
+            arena_->wait(future);
+        }
+        return future.get();
+    }
+
+private:
+    PlacementPolicy placement_;
+    std::unique_ptr<TaskArena> arena_;
+    std::vector<boost::thread> threads_;
+};
+
 class MapJob {
 public:
-    MapJob(const Specification &spec, size_t begin, size_t end):
+    MapJob(const Specification &spec, size_t begin, size_t end, 
+           PartitionedChannels *channels = NULL):
         spec_(spec),
         begin_(begin),
-        end_(end)
+        end_(end),
+        channels_(channels)
     { }
 
     std::shared_ptr<Mapper> operator()() const {
+        TRACE_SPAN("mapper", "mapreduce", "begin", begin_);
         std::shared_ptr<Mapper> m = createNewMapper(spec_.getMapper());        
         m->setUserData(spec_.getUserData());
+        m->setBroadcasts(&spec_.getBroadcasts());
+        std::unique_ptr<ChannelSink> sink;
+        if (channels_) {
+            sink.reset(new ChannelSink(*channels_, spec_.getPartitioner(), getBatchSize()));
+        }
+        m->setSink(sink.get());
         for (size_t i = begin_; i < end_; ++i) {
             std::pair<std::string, std::string> item = spec_.getDataset()->get(i);
             (*m)(item.first, item.second);
         }
+        if (sink) {
+            sink->flush();
+            m->setSink(NULL);
+        }
+        if (isLocalSortEnabled(spec_)) {
+            partitionAndSort(*m);
+        }
         return m;
     }
 
 private:
+    // Groups output by reducer partition and sorts every group by key
+    void partitionAndSort(Mapper &m) const {
+        std::shared_ptr<Partitioner> partitioner = spec_.getPartitioner();
+        std::shared_ptr<KeyComparer> comparer = spec_.getKeyComparer();
+        size_t partitionCount = spec_.getReducerCount();
+        std::vector<RecordVector> partitions(partitionCount);
+        for (auto & record : m.intermediate_) {
+            partitions[partitioner->getReducer(record.getKey(), partitionCount)].push_back(std::move(record));
+        }
+        m.intermediate_.clear();
+        m.partitionBounds_.assign(1, 0);
+        for (auto & partition : partitions) {
+            std::sort(partition.begin(), partition.end(), [comparer] (const Record &a, const Record &b) {
+                return (*comparer)(a.getKey(), b.getKey());
+            });
+            std::move(partition.begin(), partition.end(), std::back_inserter(m.intermediate_));
+            m.partitionBounds_.push_back(m.intermediate_.size());
+        }
+    }
+
+    // Several batches per partition fit into the buffer
+    size_t getBatchSize() const {
+        size_t perPartition = spec_.getEmitBufferSize() / spec_.getReducerCount();
+        return std::max<size_t>(1, std::min<size_t>(256, perPartition / 4));
+    }
+
     const Specification &spec_;
     size_t begin_;
     size_t end_;
+    PartitionedChannels *channels_;
 };
 
+using ReducerInput = std::pair<std::string, std::vector<std::string>>;
+
+template <class Fn>
+static void forEachReducerInput(std::vector<std::vector<ReducerInput>> &input, size_t index, Fn fn) {
+    for (const auto & i : input[index]) {
+        fn(i.first, i.second);
+    }
+}
+
+template <class Fn>
+static void forEachReducerInput(std::vector<std::unique_ptr<PartitionStore>> &input, size_t index, Fn fn) {
+    input[index]->forEachGroup(fn);
+}
+
+// Input is grouped records of every partition: vectors of key and values
+// pairs or partition stores of pipelined mode
+template <class Input>
 class ReduceJob {
-    using ReducerInput = std::pair<std::string, std::vector<std::string>>;
 public:
-    ReduceJob(const Specification &spec, const std::vector<std::vector<ReducerInput>> &input,
-              size_t index):
+    ReduceJob(const Specification &spec, Input &input, size_t index):
         spec_(spec),
         input_(input),
         index_(index)
     { }
 
     std::shared_ptr<Reducer> operator()() const {
+        TRACE_SPAN("reducer", "mapreduce", "index", index_);
         std::shared_ptr<Reducer> r = createNewReducer(spec_.getReducer());
         r->setUserData(spec_.getUserData());
-        for (const auto & i : input_[index_]) {
-            (*r)(i.first, i.second);
+        r->setBroadcasts(&spec_.getBroadcasts());
+        forEachReducerInput(input_, index_, [&r] (const std::string &key, const std::vector<std::string> &values) {
+            (*r)(key, values);
+        });
+        if (spec_.isSortedOutput()) {
+            std::stable_sort(r->results_.begin(), r->results_.end(), spec_.getOutputComparer());
         }
         return r;
     }
 
 private:
     const Specification &spec_;
-    const std::vector<std::vector<ReducerInput>> &input_;
+    Input &input_;
     size_t index_;
 };
 
-static void runMapTask(const Specification &spec, RecordVector &merged) {
+// Builds the input of reducer index from its partition of every mapper's
+// output (placement mode). Runs pinned like the reducer, so the input is
+// allocated and first touched on the reducer's node
+class ShuffleJob {
+public:
+    ShuffleJob(const Specification &spec, const std::vector<std::shared_ptr<Mapper>> &mappers,
+               std::vector<std::vector<ReducerInput>> &output, size_t index):
+        spec_(spec),
+        mappers_(mappers),
+        output_(output),
+        index_(index)
+    { }
+
+    void operator()() const {
+        TRACE_SPAN("shuffle", "mapreduce", "index", index_);
+        std::vector<SortedRun<Mapper::ConstIterator>> runs;
+        size_t size = 0;
+        for (const auto & m : mappers_) {
+            Mapper::ConstIterator begin = m->cbegin() + m->partitionBounds_[index_];
+            Mapper::ConstIterator end = m->cbegin() + m->partitionBounds_[index_ + 1];
+            runs.push_back(SortedRun<Mapper::ConstIterator>(begin, end));
+            size += end - begin;
+        }
+        std::shared_ptr<KeyComparer> comparer = spec_.getKeyComparer();
+        RecordVector merged(size);
+        mergeRuns(runs, merged.begin(), [comparer] (const Record &a, const Record &b) {
+            return (*comparer)(a.getKey(), b.getKey());
+        });
+        std::vector<ReducerInput> &input = output_[index_];
+        for (auto & record : merged) {
+            if (input.empty() || input.back().first != record.getKey()) {
+                input.push_back(ReducerInput(record.getKey(), std::vector<std::string>()));
+            }
+            input.back().second.push_back(record.getValue());
+        }
+    }
+
+private:
+    const Specification &spec_;
+    const std::vector<std::shared_ptr<Mapper>> &mappers_;
+    std::vector<std::vector<ReducerInput>> &output_;
+    size_t index_;
+};
+
+static std::vector<std::shared_ptr<Mapper>> runMappers(const Specification &spec) {
+    TRACE_SPAN("map phase", "mapreduce");
     size_t dataSize = spec.getDataset()->getSize();
     size_t blockSize;
     size_t threadNum;
     divideByBlocks(dataSize, spec.getMapperCount(), blockSize, threadNum, 1); 
     
-    std::vector<boost::thread> mappers;
+    JobRunner mappers(threadNum, spec.getPlacementPolicy());
     std::vector<std::future<std::shared_ptr<Mapper>>> intermediate;
 
     for (size_t i = 0; i < threadNum; ++i) {
         size_t begin = i * blockSize;
         size_t end = (i == threadNum - 1) ? dataSize : (begin + blockSize);
-        std::packaged_task<std::shared_ptr<Mapper>()> task(MapJob(spec, begin, end));
-        intermediate.push_back(task.get_future());
-        mappers.emplace_back(std::move(task));
+        intermediate.push_back(mappers.start(MapJob(spec, begin, end), i));
     }
     
     std::vector<std::shared_ptr<Mapper>> results;
-    size_t totalSize = 0;
     for (auto & f : intermediate) {
-        results.push_back(f.get());
-        totalSize += results.back()->getSize();
+        results.push_back(mappers.get(f));
     }
-    
-    merged.resize(totalSize);
-    auto outputIterator = merged.begin();
-    for (auto & m : results) {
-        outputIterator = std::copy(m->cbegin(), m->cend(), outputIterator);
+    return results;
+}
+
+static void runMapTask(const Specification &spec, RecordVector &merged) {
+    std::vector<std::shared_ptr<Mapper>> results = runMappers(spec);
+    size_t totalSize = 0;
+    for (const auto & m : results) {
+        totalSize += m->getSize();
+    }
+    merged.clear();
+    merged.reserve(totalSize);
+    for (const auto & m : results) {
+        merged.insert(merged.end(), m->cbegin(), m->cend());
     }
-    std::for_each(mappers.begin(), mappers.end(), std::mem_fn(&boost::thread::join));
 }
 
-static void runReducerTask(const Specification &spec, std::vector<std::vector<std::pair<std::string, std::vector<std::string>>>> &input, 
-        RecordVector &output) {
+// Placement mode: reducer inputs are built by jobs pinned like reducers
+static void runShuffleTask(const Specification &spec, 
+        std::vector<std::vector<ReducerInput>> &reducerTasks) {
+    std::vector<std::shared_ptr<Mapper>> mappers = runMappers(spec);
+    TRACE_SPAN("shuffle phase", "mapreduce");
+    JobRunner shufflers(spec.getReducerCount(), spec.getPlacementPolicy());
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < spec.getReducerCount(); ++i) {
+        futures.push_back(shufflers.start(ShuffleJob(spec, mappers, reducerTasks, i), i));
+    }
+    for (auto & f : futures) {
+        shufflers.get(f);
+    }
+}
 
-    std::vector<boost::thread> reducers;
+template <class Input>
+static void runReducerTask(const Specification &spec, Input &input, RecordVector &output) {
+    TRACE_SPAN("reduce phase", "mapreduce");
+    JobRunner reducers(spec.getReducerCount(), spec.getPlacementPolicy());
     std::vector<std::future<std::shared_ptr<Reducer>>> futures;
 
     for (size_t i = 0; i < spec.getReducerCount(); ++i) {
-        std::packaged_task<std::shared_ptr<Reducer>()> task(ReduceJob(spec, input, i));
-        futures.push_back(task.get_future());
-        reducers.emplace_back(std::move(task));
+        futures.push_back(reducers.start(ReduceJob<Input>(spec, input, i), i));
     }
     
     std::vector<std::shared_ptr<Reducer>> results;
     size_t totalSize = 0;
     for (auto & f : futures) {
-        results.push_back(f.get());
+        results.push_back(reducers.get(f));
         totalSize += results.back()->getSize();
     }
     
     output.resize(totalSize);
-    auto outputIterator = output.begin();
-    for (auto & r : results) {
-        outputIterator = std::copy(r->cbegin(), r->cend(), outputIterator);
+    if (spec.isSortedOutput()) {
+        std::vector<SortedRun<Reducer::ConstIterator>> runs;
+        for (auto & r : results) {
+            runs.push_back(SortedRun<Reducer::ConstIterator>(r->cbegin(), r->cend()));
+        }
+        multiwayMerge(runs, output.begin(), spec.getReducerCount(), spec.getOutputComparer(),
+                spec.getPlacementPolicy());
+    } else {
+        auto outputIterator = output.begin();
+        for (auto & r : results) {
+            outputIterator = std::copy(r->cbegin(), r->cend(), outputIterator);
+        }
+    }
+}
+
+// Pipelined mode: mappers stream records through bounded channels while one
+// consumer per partition groups them, map and shuffle phases overlap
+static void runPipelinedMapTask(const Specification &spec, 
+        std::vector<std::unique_ptr<PartitionStore>> &partitions) {
+    TRACE_SPAN("pipelined map phase", "mapreduce");
+    size_t partitionCount = spec.getReducerCount();
+    PartitionedChannels channels(partitionCount, spec.getEmitBufferSize());
+    size_t spillThreshold = spec.getSpillThreshold();
+    if (spillThreshold != 0) {
+        spillThreshold = std::max<size_t>(1, spillThreshold / partitionCount);
+    }
+    partitions.clear();
+    for (size_t p = 0; p < partitionCount; ++p) {
+        partitions.emplace_back(new PartitionStore(spec.getKeyComparer(), spillThreshold));
+    }
+    
+    // Consumer of partition p runs where reducer p will run. A failed
+    // consumer keeps draining its channel, so that mappers do not block
+    std::vector<boost::thread> consumers;
+    std::vector<std::exception_ptr> consumerErrors(partitionCount);
+    PlacementPolicy placement = spec.getPlacementPolicy();
+    for (size_t p = 0; p < partitionCount; ++p) {
+        consumers.emplace_back([&channels, &partitions, &consumerErrors, p, placement] {
+            pinCurrentThread(p, placement);
+            TRACE_SPAN("partition consumer", "mapreduce", "index", p);
+            RecordVector batch;
+            while (channels.getChannel(p).pop(batch)) {
+                if (consumerErrors[p]) {
+                    continue;
+                }
+                try {
+                    for (const auto & record : batch) {
+                        partitions[p]->add(record);
+                    }
+                } catch (...) {
+                    consumerErrors[p] = std::current_exception();
+                }
+            }
+        });
+    }
+
+    size_t dataSize = spec.getDataset()->getSize();
+    size_t blockSize;
+    size_t threadNum;
+    divideByBlocks(dataSize, spec.getMapperCount(), blockSize, threadNum, 1); 
+    
+    std::unique_ptr<JobRunner> mappers(new JobRunner(threadNum, placement, true));
+    std::vector<std::future<std::shared_ptr<Mapper>>> futures;
+    for (size_t i = 0; i < threadNum; ++i) {
+        size_t begin = i * blockSize;
+        size_t end = (i == threadNum - 1) ? dataSize : (begin + blockSize);
+        futures.push_back(mappers->start(MapJob(spec, begin, end, &channels), i));
+    }
+    
+    std::exception_ptr error;
+    for (auto & f : futures) {
+        try {
+            mappers->get(f);
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    channels.close();
+    mappers.reset();
+    std::for_each(consumers.begin(), consumers.end(), std::mem_fn(&boost::thread::join));
+    for (const auto & consumerError : consumerErrors) {
+        if (!error && consumerError) {
+            error = consumerError;
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
     }
-    std::for_each(reducers.begin(), reducers.end(), std::mem_fn(&boost::thread::join));
 }
 
 static bool isSpecificationReady(const Specification &spec) {
-    return !spec.getMapper().empty() && !spec.getReducer().empty() &&
+    return !spec.getMapper().empty() && (spec.isMapOnly() || !spec.getReducer().empty()) &&
         spec.getDataset();
 }
 
@@ -134,32 +407,53 @@ void RunComputation(const Specification &spec, RecordVector &out) {
     if (!isSpecificationReady(spec)) {
         throw std::invalid_argument("Invalid specification. Fill all necessary fields. (MapReduce::RunComputation)");
     }
+    if (spec.isMapOnly()) {
+        runMapTask(spec, out);
+        if (spec.isSortedOutput()) {
+            quickSort(out.begin(), out.end(), spec.getSorterCount(), spec.getOutputComparer());
+        }
+        return;
+    }
+    if (spec.isPipelined()) {
+        std::vector<std::unique_ptr<PartitionStore>> partitions;
+        runPipelinedMapTask(spec, partitions);
+        runReducerTask(spec, partitions, out);
+        return;
+    }
+    std::vector<std::vector<ReducerInput>> reducerTasks(spec.getReducerCount());
+    if (isLocalSortEnabled(spec)) {
+        runShuffleTask(spec, reducerTasks);
+        runReducerTask(spec, reducerTasks, out);
+        return;
+    }
     RecordVector mergedVector;
     runMapTask(spec, mergedVector);
 
     std::shared_ptr<KeyComparer> comparer = spec.getKeyComparer();
-   
-    quickSort(mergedVector.begin(), mergedVector.end(), spec.getSorterCount(), [comparer] (const Record &a, const Record &b) {
-            return (*comparer)(a.getKey(), b.getKey());
-    });
+    {
+        TRACE_SPAN("sort phase", "mapreduce");
+        quickSort(mergedVector.begin(), mergedVector.end(), spec.getSorterCount(), [comparer] (const Record &a, const Record &b) {
+                return (*comparer)(a.getKey(), b.getKey());
+        });
+    }
 
-    using reducerInput = std::pair<std::string, std::vector<std::string>>;
-    std::vector<std::vector<reducerInput>> reducerTasks(spec.getReducerCount());
-    
     std::shared_ptr<Partitioner> partitioner = spec.getPartitioner();
 
-    size_t i = 0;
-    while (i < mergedVector.size()) {
-        reducerInput p;
-        p.first = mergedVector[i].getKey();
+    {
+        TRACE_SPAN("shuffle phase", "mapreduce");
+        size_t i = 0;
+        while (i < mergedVector.size()) {
+            ReducerInput p;
+            p.first = mergedVector[i].getKey();
 
-        while (i < mergedVector.size() && mergedVector[i].getKey() == p.first) {
-            p.second.push_back(mergedVector[i].getValue());
-            ++i;
-        }
+            while (i < mergedVector.size() && mergedVector[i].getKey() == p.first) {
+                p.second.push_back(mergedVector[i].getValue());
+                ++i;
+            }
         
-        size_t reducerIndex = partitioner->getReducer(p.first, spec.getReducerCount());
-        reducerTasks[reducerIndex].push_back(p);
+            size_t reducerIndex = partitioner->getReducer(p.first, spec.getReducerCount());
+            reducerTasks[reducerIndex].push_back(p);
+        }
     }
 
     runReducerTask(spec, reducerTasks, out);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+#include "base.hpp"
+#include "broadcast.hpp"
+
+namespace MapReduce {
+
+/* Map side join against broadcast table */
+
+// Looks up every input record in the broadcast table and calls join() for
+// matches. Together with Specification::setMapOnly the join needs no shuffle.
+template <class V>
+class MapJoinMapper: public Mapper {
+public:
+    MapJoinMapper(): table_(NULL) { }
+
+    virtual void operator() (const std::string &key, const std::string &value) {
+        // The table is resolved on the first record, a mapper serves one job
+        if (!table_) {
+            table_ = &getBroadcast<V>(getTableName());
+        }
+        const V *right = table_->find(getJoinKey(key, value));
+        if (right) {
+            join(key, value, *right);
+        } else {
+            unmatched(key, value);
+        }
+    }
+
+    // Name of the broadcast table registered in Specification
+    virtual std::string getTableName() const = 0;
+
+    virtual std::string getJoinKey(const std::string &key, const std::string &value) const {
+        return key;
+    }
+
+    virtual void join(const std::string &key, const std::string &value, const V &right) = 0;
+
+    // Inner join by default, override to implement left outer join
+    virtual void unmatched(const std::string &key, const std::string &value) { }
+
+private:
+    const BroadcastTable<V> *table_;
+};
+
+} // namespace MapReduce
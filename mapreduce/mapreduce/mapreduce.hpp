@@ -3,9 +3,12 @@
 // Includes necessary MapReduce headers
 #include "dataset.hpp"
 #include "base.hpp"
+#include "broadcast.hpp"
+#include "join.hpp"
 #include "registerer.hpp"
 #include "specification.hpp"
 #include "computation.hpp"
+#include "streaming.hpp"
 
 
 
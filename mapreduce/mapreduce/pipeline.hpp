@@ -0,0 +1,323 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+
+#include "base.hpp"
+
+namespace MapReduce {
+
+/* Bounded buffers between mappers and reducer partitions (pipelined mode) */
+
+// Blocking queue of record batches. Producers wait while the channel holds
+// capacity records, so slow consumers throttle mappers instead of letting
+// intermediate data grow without limit.
+class RecordChannel {
+public:
+    RecordChannel(size_t capacity):
+        capacity_(capacity),
+        size_(0),
+        closed_(false)
+    { }
+
+    void push(RecordVector &batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Batch larger than capacity is accepted when the channel is empty
+        notFull_.wait(lock, [this, &batch] {
+            return size_ == 0 || size_ + batch.size() <= capacity_;
+        });
+        size_ += batch.size();
+        batches_.push_back(RecordVector());
+        batches_.back().swap(batch);
+        notEmpty_.notify_one();
+    }
+
+    // Returns false when channel is closed and drained
+    bool pop(RecordVector &batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] {
+            return !batches_.empty() || closed_;
+        });
+        if (batches_.empty()) {
+            return false;
+        }
+        batch.swap(batches_.front());
+        batches_.pop_front();
+        size_ -= batch.size();
+        notFull_.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    size_t size_;
+    bool closed_;
+    std::deque<RecordVector> batches_;
+    std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+};
+
+// One channel per reducer partition
+class PartitionedChannels {
+public:
+    // bufferSize is the total number of records buffered across all partitions
+    PartitionedChannels(size_t partitionCount, size_t bufferSize) {
+        size_t capacity = std::max<size_t>(1, bufferSize / partitionCount);
+        for (size_t i = 0; i < partitionCount; ++i) {
+            channels_.emplace_back(new RecordChannel(capacity));
+        }
+    }
+
+    size_t getPartitionCount() const { return channels_.size(); }
+    RecordChannel &getChannel(size_t partition) { return *channels_[partition]; }
+
+    void close() {
+        for (auto &channel : channels_) {
+            channel->close();
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<RecordChannel>> channels_;
+};
+
+// Mapper side of the pipeline: partitions emitted records and sends them in
+// small batches to amortize channel locking
+class ChannelSink: public IntermediateSink {
+public:
+    ChannelSink(PartitionedChannels &channels, std::shared_ptr<Partitioner> partitioner,
+                size_t batchSize):
+        channels_(channels),
+        partitioner_(partitioner),
+        batchSize_(batchSize),
+        batches_(channels.getPartitionCount())
+    { }
+
+    virtual void emit(const std::string &key, const std::string &value) {
+        size_t partition = partitioner_->getReducer(key, channels_.getPartitionCount());
+        batches_[partition].push_back(Record(key, value));
+        if (batches_[partition].size() >= batchSize_) {
+            channels_.getChannel(partition).push(batches_[partition]);
+            batches_[partition].clear();
+        }
+    }
+
+    void flush() {
+        for (size_t i = 0; i < batches_.size(); ++i) {
+            if (!batches_[i].empty()) {
+                channels_.getChannel(i).push(batches_[i]);
+                batches_[i].clear();
+            }
+        }
+    }
+
+private:
+    PartitionedChannels &channels_;
+    std::shared_ptr<Partitioner> partitioner_;
+    size_t batchSize_;
+    std::vector<RecordVector> batches_;
+};
+
+// Sorted groups of one partition in an anonymous temporary file, removed
+// when the run is destroyed
+class SpillRun {
+public:
+    SpillRun():
+        file_(std::tmpfile())
+    {
+        if (!file_) {
+            throw std::runtime_error("Failed to create spill file (SpillRun::SpillRun)");
+        }
+    }
+
+    SpillRun(const SpillRun &rhs) = delete;
+    SpillRun &operator= (const SpillRun &rhs) = delete;
+
+    ~SpillRun() {
+        std::fclose(file_);
+    }
+
+    void write(const std::string &key, const std::vector<std::string> &values) {
+        writeString(key);
+        writeSize(values.size());
+        for (const auto &value : values) {
+            writeString(value);
+        }
+    }
+
+    // Prepares the run for reading from the beginning
+    void rewind() {
+        if (std::fflush(file_) != 0) {
+            throw std::runtime_error("Failed to write spill file (SpillRun::rewind)");
+        }
+        std::rewind(file_);
+    }
+
+    // Returns false at the end of the run
+    bool read(std::string &key, std::vector<std::string> &values) {
+        uint64_t keySize;
+        if (std::fread(&keySize, sizeof(keySize), 1, file_) != 1) {
+            return false;
+        }
+        readString(keySize, key);
+        values.resize(readSize());
+        for (auto &value : values) {
+            readString(readSize(), value);
+        }
+        return true;
+    }
+
+private:
+    void writeSize(uint64_t size) {
+        if (std::fwrite(&size, sizeof(size), 1, file_) != 1) {
+            throw std::runtime_error("Failed to write spill file (SpillRun::write)");
+        }
+    }
+
+    void writeString(const std::string &s) {
+        writeSize(s.size());
+        if (!s.empty() && std::fwrite(s.data(), 1, s.size(), file_) != s.size()) {
+            throw std::runtime_error("Failed to write spill file (SpillRun::write)");
+        }
+    }
+
+    uint64_t readSize() {
+        uint64_t size;
+        if (std::fread(&size, sizeof(size), 1, file_) != 1) {
+            throw std::runtime_error("Spill file is truncated (SpillRun::read)");
+        }
+        return size;
+    }
+
+    void readString(uint64_t size, std::string &s) {
+        s.resize(size);
+        if (size != 0 && std::fread(&s[0], 1, size, file_) != size) {
+            throw std::runtime_error("Spill file is truncated (SpillRun::read)");
+        }
+    }
+
+    std::FILE *file_;
+};
+
+// Grouped records of one reducer partition. With non-zero spillThreshold
+// the groups are written as a sorted run to a temporary file every time they
+// hold spillThreshold values, and forEachGroup merges runs by key, so memory
+// holds at most spillThreshold values plus one group per run
+class PartitionStore {
+private:
+    struct KeyLess {
+        bool operator() (const std::string &a, const std::string &b) const {
+            return (*comparer)(a, b);
+        }
+        std::shared_ptr<KeyComparer> comparer;
+    };
+
+    using GroupedRecords = std::map<std::string, std::vector<std::string>, KeyLess>;
+
+public:
+    PartitionStore(std::shared_ptr<KeyComparer> comparer, size_t spillThreshold):
+        keyLess_{comparer},
+        groups_(keyLess_),
+        size_(0),
+        spillThreshold_(spillThreshold)
+    { }
+
+    void add(const Record &record) {
+        groups_[record.getKey()].push_back(record.getValue());
+        if (spillThreshold_ != 0 && ++size_ >= spillThreshold_) {
+            spill();
+        }
+    }
+
+    size_t getSpillCount() const { return runs_.size(); }
+
+    // Calls fn(key, values) for every key in key order, values of a key come
+    // in the order they were added. Reads the runs, so it is called once
+    template <class Fn>
+    void forEachGroup(Fn fn) {
+        if (runs_.empty()) {
+            for (const auto &item : groups_) {
+                fn(item.first, item.second);
+            }
+            return;
+        }
+        std::vector<Head> heads(runs_.size());
+        for (size_t i = 0; i < runs_.size(); ++i) {
+            runs_[i]->rewind();
+            heads[i].valid = runs_[i]->read(heads[i].key, heads[i].values);
+        }
+        auto memory = groups_.cbegin();
+        std::string key;
+        std::vector<std::string> values;
+        while (true) {
+            const std::string *minKey = nullptr;
+            for (const auto &head : heads) {
+                if (head.valid && (!minKey || keyLess_(head.key, *minKey))) {
+                    minKey = &head.key;
+                }
+            }
+            if (memory != groups_.cend() && (!minKey || keyLess_(memory->first, *minKey))) {
+                minKey = &memory->first;
+            }
+            if (!minKey) {
+                break;
+            }
+            key = *minKey;
+            values.clear();
+            // Earlier runs hold earlier values
+            for (size_t i = 0; i < heads.size(); ++i) {
+                if (heads[i].valid && !keyLess_(key, heads[i].key)) {
+                    values.insert(values.end(), heads[i].values.begin(), heads[i].values.end());
+                    heads[i].valid = runs_[i]->read(heads[i].key, heads[i].values);
+                }
+            }
+            if (memory != groups_.cend() && !keyLess_(key, memory->first)) {
+                values.insert(values.end(), memory->second.begin(), memory->second.end());
+                ++memory;
+            }
+            fn(key, values);
+        }
+    }
+
+private:
+    struct Head {
+        Head(): valid(false) { }
+        std::string key;
+        std::vector<std::string> values;
+        bool valid;
+    };
+
+    void spill() {
+        runs_.emplace_back(new SpillRun());
+        for (const auto &item : groups_) {
+            runs_.back()->write(item.first, item.second);
+        }
+        groups_.clear();
+        size_ = 0;
+    }
+
+    KeyLess keyLess_;
+    GroupedRecords groups_;
+    // Values in groups_
+    size_t size_;
+    size_t spillThreshold_;
+    std::vector<std::unique_ptr<SpillRun>> runs_;
+};
+
+} // namespace MapReduce
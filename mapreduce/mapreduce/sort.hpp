@@ -2,56 +2,147 @@
 
 #include <functional>
 #include <iterator>
+#include <vector>
+#include <queue>
+#include <utility>
+#include <algorithm>
 
 #include <pool.hpp>
+#include <parallel.hpp>
+#include <executor.hpp>
+#include <trace.hpp>
 
 namespace MapReduce {
 
-template <class ForwardIt, class Compare>
-static void insertionSort(ForwardIt first, ForwardIt last, Compare cmp) {
-    if (std::distance(first, last) < 2) {
-        return;
+// Sorts on the process-wide executor, using at most threadCount of its workers
+template <class ForwardIt, class Compare = 
+          std::less<typename std::iterator_traits<ForwardIt>::value_type>>
+void quickSort(ForwardIt first, ForwardIt last, size_t threadCount = std::thread::hardware_concurrency(), 
+                                Compare cmp = Compare()) {
+    TaskArena arena(DefaultExecutor::get(), std::max<size_t>(1, threadCount));
+    parallelSort(arena, first, last, cmp);
+}
+
+template <class RandomIt>
+using SortedRun = std::pair<RandomIt, RandomIt>;
+
+// Merges part of every run into out with a heap of run heads. Among equal
+// elements the one from the run with smaller index goes first.
+template <class RandomIt, class OutputIt, class Compare>
+static void mergeRuns(std::vector<SortedRun<RandomIt>> runs, OutputIt out, Compare cmp) {
+    auto heapCmp = [&runs, cmp] (size_t a, size_t b) {
+        if (cmp(*runs[a].first, *runs[b].first)) {
+            return false;
+        }
+        return cmp(*runs[b].first, *runs[a].first) || a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(heapCmp)> heads(heapCmp);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if (runs[i].first != runs[i].second) {
+            heads.push(i);
+        }
     }
-    for (auto pi = first + 1; pi != last; ++pi) {
-        for (auto pj = pi; pj != first && cmp(*pj, *(pj - 1)); --pj) {
-            std::swap(*pj, *(pj - 1));
+    while (heads.size() > 1) {
+        size_t i = heads.top();
+        heads.pop();
+        *out = *runs[i].first;
+        ++out;
+        if (++runs[i].first != runs[i].second) {
+            heads.push(i);
         }
     }
+    if (!heads.empty()) {
+        std::copy(runs[heads.top()].first, runs[heads.top()].second, out);
+    }
 }
 
-template <class ForwardIt, class Compare>
-static void doQuickSort(ForwardIt first, ForwardIt last, ThreadPool &threadPool, Compare cmp) {
-    using T = typename std::iterator_traits<ForwardIt>::value_type;
-    while (true) {
-        if (first == last) {
-            return;
+// Merge task per part, bounds[j][r] is the start of part j in run r
+template <class Executor, class RandomIt, class OutputIt, class Compare>
+static void mergeParts(Executor &executor, const std::vector<SortedRun<RandomIt>> &runs,
+                       const std::vector<std::vector<RandomIt>> &bounds,
+                       const std::vector<size_t> &offsets, OutputIt out, Compare cmp) {
+    size_t parts = bounds.size() - 1;
+    FutureVector<void> results;
+    for (size_t j = 0; j < parts; ++j) {
+        std::vector<SortedRun<RandomIt>> part;
+        for (size_t r = 0; r < runs.size(); ++r) {
+            part.push_back(SortedRun<RandomIt>(bounds[j][r], bounds[j + 1][r]));
         }
-        auto diff = std::distance(first, last);
-        if (diff < 10) {
-            insertionSort(first, last, cmp);
-            return;
-        }
-        
-        T pivot = *std::next(first, diff / 2);
-
-        auto middle1 = std::partition(first, last, [pivot, cmp] (const T &item) { 
-            return cmp(item, pivot); 
-        });
-        auto middle2 = std::partition(middle1, last, [pivot, cmp] (const T &item) { 
-            return !cmp(pivot, item); 
-        });
-        
-        threadPool.addTask(std::bind(doQuickSort<ForwardIt, Compare>, middle2, last, std::ref(threadPool), cmp));
-        last = middle1; 
-    } 
+        OutputIt partOut = std::next(out, offsets[j]);
+        results.push_back(executor.addTask([part, partOut, cmp] {
+            TRACE_SPAN("merge task", "sort");
+            mergeRuns(part, partOut, cmp);
+        }));
+    }
+    for (auto &f : results) {
+        executor.wait(f);
+        f.get();
+    }
 }
 
-template <class ForwardIt, class Compare = 
-          std::less<typename std::iterator_traits<ForwardIt>::value_type>>
-void quickSort(ForwardIt first, ForwardIt last, size_t threadCount = std::thread::hardware_concurrency(), 
-                                Compare cmp = Compare()) {
-    ThreadPool threadPool(threadCount);
-    doQuickSort(first, last, threadPool, cmp);
+// Parallel k-way merge of sorted runs into [out, out + total size). Output is
+// split into parts by splitters sampled from the runs, each part is located
+// in every run with lower_bound and merged by its own task. The result does
+// not depend on threadCount: it is the stable merge in run order. Parts run
+// on the process-wide executor, with a placement policy on pinned threads
+// of their own.
+template <class RandomIt, class OutputIt, class Compare>
+void multiwayMerge(const std::vector<SortedRun<RandomIt>> &runs, OutputIt out, 
+                   size_t threadCount, Compare cmp, 
+                   PlacementPolicy placement = PlacementPolicy::None) {
+    using T = typename std::iterator_traits<RandomIt>::value_type;
+    const size_t MinPartSize = 4096;
+    const size_t Oversampling = 8;
+
+    size_t total = 0;
+    for (const auto &run : runs) {
+        total += std::distance(run.first, run.second);
+    }
+    size_t parts = std::max<size_t>(1, std::min(threadCount, total / MinPartSize));
+    if (parts == 1) {
+        mergeRuns(runs, out, cmp);
+        return;
+    }
+
+    std::vector<T> samples;
+    for (const auto &run : runs) {
+        size_t size = std::distance(run.first, run.second);
+        size_t count = std::min(size, parts * Oversampling);
+        for (size_t i = 0; i < count; ++i) {
+            samples.push_back(*std::next(run.first, (2 * i + 1) * size / (2 * count)));
+        }
+    }
+    std::sort(samples.begin(), samples.end(), cmp);
+
+    // bounds[j][r] is the start of part j in run r
+    std::vector<std::vector<RandomIt>> bounds(parts + 1);
+    std::vector<size_t> offsets(parts + 1, 0);
+    for (size_t r = 0; r < runs.size(); ++r) {
+        bounds[0].push_back(runs[r].first);
+        bounds[parts].push_back(runs[r].second);
+    }
+    for (size_t j = 1; j < parts; ++j) {
+        const T &splitter = samples[j * samples.size() / parts];
+        for (size_t r = 0; r < runs.size(); ++r) {
+            bounds[j].push_back(std::lower_bound(bounds[j - 1][r], runs[r].second, splitter, cmp));
+        }
+    }
+    for (size_t j = 0; j < parts; ++j) {
+        offsets[j + 1] = offsets[j];
+        for (size_t r = 0; r < runs.size(); ++r) {
+            offsets[j + 1] += std::distance(bounds[j][r], bounds[j + 1][r]);
+        }
+    }
+
+    if (placement == PlacementPolicy::None) {
+        TaskArena arena(DefaultExecutor::get(), parts);
+        mergeParts(arena, runs, bounds, offsets, out, cmp);
+    } else {
+        ThreadPoolOptions options;
+        options.setPlacementPolicy(placement);
+        ThreadPool threadPool(parts, options);
+        mergeParts(threadPool, runs, bounds, offsets, out, cmp);
+    }
 }
 
 } // namespace MapReduce
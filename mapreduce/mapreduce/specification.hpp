@@ -1,20 +1,32 @@
 #pragma once
 
 #include <memory>
+#include <functional>
 
+#include <numa.hpp>
+
+#include "base.hpp"
 #include "dataset.hpp"
 #include "registerer.hpp"
+#include "broadcast.hpp"
 
 namespace MapReduce {
 
 /* MapReduce configuration */
 
+using RecordComparer = std::function<bool (const Record &, const Record &)>;
+
 class Specification {
 public:
     Specification():
         mapperCount_(1),
         reducerCount_(1),
         sorterCount_(1),
+        mapOnly_(false),
+        sortedOutput_(false),
+        emitBufferSize_(0),
+        spillThreshold_(0),
+        placement_(PlacementPolicy::None),
         userData_(NULL)
     { }
 
@@ -98,6 +110,79 @@ public:
     void setUserData(void *data) { userData_ = data; }
     void *getUserData() const { return userData_; }
 
+    // Registers read-only side input available to all mappers and reducers
+    template <class V>
+    void addBroadcast(const std::string &name, std::shared_ptr<const BroadcastTable<V>> table) {
+        if (!table) {
+            throw std::invalid_argument("Invalid table parameter (Specification::addBroadcast)");
+        }
+        broadcasts_[name] = table;
+    }
+
+    template <class V, class Iterator>
+    void addBroadcast(const std::string &name, Iterator begin, Iterator end) {
+        addBroadcast(name, makeBroadcastTable<V>(begin, end));
+    }
+
+    void removeBroadcast(const std::string &name) { broadcasts_.erase(name); }
+
+    template <class V>
+    const BroadcastTable<V> &getBroadcast(const std::string &name) const {
+        return findBroadcast<V>(&broadcasts_, name);
+    }
+
+    const BroadcastMap &getBroadcasts() const { return broadcasts_; }
+
+    // Non-zero size enables pipelined execution: mappers push records into
+    // bounded per-partition buffers (size is total record count) while
+    // partitions are grouped concurrently. Mappers block when buffers are full.
+    // The buffers bound records in flight only, grouped records stay in
+    // memory until reducers run unless a spill threshold is set
+    void setEmitBufferSize(size_t size) { emitBufferSize_ = size; }
+    size_t getEmitBufferSize() const { return emitBufferSize_; }
+    bool isPipelined() const { return emitBufferSize_ != 0; }
+
+    // Pipelined mode only: a partition holding more than records / reducer
+    // count grouped values writes them to a temporary file as a sorted run,
+    // reducers merge the runs. Grouped data in memory is then about records
+    // values. 0 (default) never spills
+    void setSpillThreshold(size_t records) { spillThreshold_ = records; }
+    size_t getSpillThreshold() const { return spillThreshold_; }
+
+    // Pins mapper, shuffle, merge and reducer threads to cores. Mappers then
+    // split their output by partition and sort it in node-local memory, and
+    // the input of reducer p is merged from these runs by a thread pinned
+    // like reducer p, instead of sorting one merged vector across nodes
+    void setPlacementPolicy(PlacementPolicy placement) { placement_ = placement; }
+    PlacementPolicy getPlacementPolicy() const { return placement_; }
+
+    // Sorted output is produced by reducers sorting their own results and
+    // parallel merge of them. By default records are ordered by key with KeyComparer
+    void setSortedOutput(bool sorted) { sortedOutput_ = sorted; }
+    bool isSortedOutput() const { return sortedOutput_; }
+
+    void setOutputComparer(const RecordComparer &comparer) {
+        if (!comparer) {
+            throw std::invalid_argument("Invalid comparer parameter (Specification::setOutputComparer)");
+        }
+        outputComparer_ = comparer;
+        sortedOutput_ = true;
+    }
+
+    RecordComparer getOutputComparer() const {
+        if (!outputComparer_) {
+            std::shared_ptr<KeyComparer> comparer = getKeyComparer();
+            return [comparer] (const Record &a, const Record &b) {
+                return (*comparer)(a.getKey(), b.getKey());
+            };
+        }
+        return outputComparer_;
+    }
+
+    // Map only jobs skip sort and reduce phases: mapper output is the result
+    void setMapOnly(bool mapOnly) { mapOnly_ = mapOnly; }
+    bool isMapOnly() const { return mapOnly_; }
+
 private:
     std::string mapper_;
     std::string reducer_;
@@ -107,7 +192,14 @@ private:
     size_t mapperCount_;
     size_t reducerCount_;
     size_t sorterCount_;
+    bool mapOnly_;
+    bool sortedOutput_;
+    RecordComparer outputComparer_;
+    size_t emitBufferSize_;
+    size_t spillThreshold_;
+    PlacementPolicy placement_;
     void *userData_;
+    BroadcastMap broadcasts_;
 };
 
 } // namespace MapReduce
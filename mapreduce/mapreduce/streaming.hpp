@@ -0,0 +1,215 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "base.hpp"
+#include "dataset.hpp"
+#include "specification.hpp"
+#include "computation.hpp"
+
+namespace MapReduce {
+
+/* Windowed micro-batch processing of continuously growing input */
+
+// Dataset which may be appended to while computations are reading it
+class AppendableDataset: public Dataset {
+public:
+    void append(const std::string &key, const std::string &value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        records_.push_back(std::make_pair(key, value));
+    }
+
+    template <class Iterator>
+    void append(Iterator begin, Iterator end) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        records_.insert(records_.end(), begin, end);
+    }
+
+    virtual size_t getSize() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return records_.size();
+    }
+
+    virtual std::pair<const std::string, std::string> get(const size_t index) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index >= records_.size()) {
+            throw std::runtime_error("Index out of bounds (AppendableDataset::get)");
+        }
+        return records_[index];
+    }
+
+    // Copies records [begin, end) under a single lock
+    void read(size_t begin, size_t end, std::vector<std::pair<std::string, std::string>> &out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (begin > end || end > records_.size()) {
+            throw std::runtime_error("Index out of bounds (AppendableDataset::read)");
+        }
+        out.assign(records_.begin() + begin, records_.begin() + end);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::deque<std::pair<std::string, std::string>> records_;
+};
+
+// Window length and step, both measured in micro-batches
+class WindowSpec {
+public:
+    static WindowSpec tumbling(size_t size) {
+        if (size == 0) {
+            throw std::invalid_argument("Invalid size parameter (WindowSpec::tumbling)");
+        }
+        return WindowSpec(size, size);
+    }
+
+    static WindowSpec sliding(size_t size, size_t slide) {
+        if (size == 0 || slide == 0 || slide > size) {
+            throw std::invalid_argument("Invalid window parameters (WindowSpec::sliding)");
+        }
+        return WindowSpec(size, slide);
+    }
+
+    size_t getSize() const { return size_; }
+    size_t getSlide() const { return slide_; }
+
+private:
+    WindowSpec(size_t size, size_t slide):
+        size_(size),
+        slide_(slide)
+    { }
+
+    size_t size_;
+    size_t slide_;
+};
+
+class WindowResult {
+public:
+    WindowResult(size_t firstBatch, size_t lastBatch):
+        firstBatch_(firstBatch),
+        lastBatch_(lastBatch)
+    { }
+
+    // Inclusive range of micro-batches covered by the window
+    size_t getFirstBatch() const { return firstBatch_; }
+    size_t getLastBatch() const { return lastBatch_; }
+
+    const RecordVector &getRecords() const { return records_; }
+    RecordVector &getRecords() { return records_; }
+
+private:
+    size_t firstBatch_;
+    size_t lastBatch_;
+    RecordVector records_;
+};
+
+// Runs the specification over every new portion of the source and keeps
+// per-key reducer output of the last window.size batches (panes). Window
+// results are computed by reducing pane values of each key again, so the
+// reducer must accept its own output as input (emit records with the same
+// key, like a combiner: counts, sums, min/max). All values emitted for a key
+// are kept and passed to the window reduce.
+class StreamingComputation {
+    using Pane = std::unordered_map<std::string, std::vector<std::string>>;
+public:
+    StreamingComputation(const Specification &spec, std::shared_ptr<AppendableDataset> source,
+                         const WindowSpec &window = WindowSpec::tumbling(1)):
+        spec_(spec),
+        source_(source),
+        window_(window),
+        offset_(0),
+        batchCount_(0),
+        maxBatchSize_(0)
+    {
+        if (!source_) {
+            throw std::invalid_argument("Invalid source parameter (StreamingComputation::StreamingComputation)");
+        }
+    }
+
+    // Upper bound for records consumed by one batch, 0 means everything available
+    void setMaxBatchSize(size_t size) { maxBatchSize_ = size; }
+    size_t getMaxBatchSize() const { return maxBatchSize_; }
+
+    size_t getBatchCount() const { return batchCount_; }
+    size_t getOffset() const { return offset_; }
+
+    // Processes next micro-batch. Returns false if there were no new records,
+    // otherwise appends windows closed by this batch to out
+    bool runBatch(std::vector<WindowResult> &out) {
+        size_t available = source_->getSize();
+        if (available == offset_) {
+            return false;
+        }
+        size_t end = (maxBatchSize_ == 0) ? available : std::min(available, offset_ + maxBatchSize_);
+
+        std::vector<std::pair<std::string, std::string>> batch;
+        source_->read(offset_, end, batch);
+        spec_.setDataset(makeDatasetFromContainer(batch.begin(), batch.end()));
+        RecordVector batchResults;
+        RunComputation(spec_, batchResults);
+        spec_.setDataset(source_);
+        offset_ = end;
+
+        panes_.push_back(Pane());
+        for (const auto &record : batchResults) {
+            panes_.back()[record.getKey()].push_back(record.getValue());
+        }
+        if (panes_.size() > window_.getSize()) {
+            panes_.pop_front();
+        }
+        size_t batchIndex = batchCount_++;
+
+        if (batchCount_ % window_.getSlide() == 0) {
+            size_t first = (batchCount_ > window_.getSize()) ? batchCount_ - window_.getSize() : 0;
+            out.push_back(WindowResult(first, batchIndex));
+            if (panes_.size() == 1) {
+                out.back().getRecords().swap(batchResults);
+            } else {
+                reduceWindow(out.back().getRecords());
+            }
+        }
+        return true;
+    }
+
+private:
+    void reduceWindow(RecordVector &out) {
+        std::unordered_map<std::string, std::vector<std::string>> grouped;
+        for (const auto &pane : panes_) {
+            for (const auto &item : pane) {
+                std::vector<std::string> &values = grouped[item.first];
+                values.insert(values.end(), item.second.begin(), item.second.end());
+            }
+        }
+        std::shared_ptr<Partitioner> partitioner = spec_.getPartitioner();
+        std::vector<std::vector<ReducerInput>> reducerTasks(spec_.getReducerCount());
+        for (auto &item : grouped) {
+            size_t reducerIndex = partitioner->getReducer(item.first, spec_.getReducerCount());
+            reducerTasks[reducerIndex].push_back(ReducerInput(item.first, std::vector<std::string>()));
+            reducerTasks[reducerIndex].back().second.swap(item.second);
+        }
+        std::shared_ptr<KeyComparer> comparer = spec_.getKeyComparer();
+        for (auto &task : reducerTasks) {
+            std::sort(task.begin(), task.end(), [comparer] (const ReducerInput &a, const ReducerInput &b) {
+                return (*comparer)(a.first, b.first);
+            });
+        }
+        runReducerTask(spec_, reducerTasks, out);
+    }
+
+    Specification spec_;
+    std::shared_ptr<AppendableDataset> source_;
+    WindowSpec window_;
+    size_t offset_;
+    size_t batchCount_;
+    size_t maxBatchSize_;
+    std::deque<Pane> panes_;
+};
+
+} // namespace MapReduce
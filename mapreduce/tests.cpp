@@ -0,0 +1,460 @@
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <memory>
+#include <cstdlib>
+#include <random>
+#include <algorithm>
+
+#include <mapreduce/mapreduce.hpp>
+#define BOOST_TEST_MODULE MapReduceTest
+#include <boost/test/included/unit_test.hpp>
+
+class WordCountMapper: public MapReduce::Mapper {
+public:
+    virtual void operator() (const std::string &key, const std::string &value) {
+        std::istringstream words(value);
+        std::string word;
+        while (words >> word) {
+            emitIntermediate(word, "1");
+        }
+    }
+};
+
+REGISTER_MAPPER(WordCountMapper)
+
+class WordCountReducer: public MapReduce::Reducer {
+public:
+    virtual void operator() (const std::string &key, const ValueVector &values) {
+        size_t totalCount = 0;
+        for (const auto &value : values) {
+            totalCount += std::atoi(value.c_str());
+        }
+        emit(key, std::to_string(totalCount));
+    }
+};
+
+REGISTER_REDUCER(WordCountReducer)
+
+// "key value" lines, emits value for key
+class PairMapper: public MapReduce::Mapper {
+public:
+    virtual void operator() (const std::string &key, const std::string &value) {
+        std::istringstream fields(value);
+        std::string first, second;
+        fields >> first >> second;
+        emitIntermediate(first, second);
+    }
+};
+
+REGISTER_MAPPER(PairMapper)
+
+// Emits every distinct value of a key, so several records per key
+class DistinctValuesReducer: public MapReduce::Reducer {
+public:
+    virtual void operator() (const std::string &key, const ValueVector &values) {
+        std::set<std::string> distinct(values.begin(), values.end());
+        for (const auto &value : distinct) {
+            emit(key, value);
+        }
+    }
+};
+
+REGISTER_REDUCER(DistinctValuesReducer)
+
+// Orders keyed by customer joined with the "cities" broadcast, orders of
+// unknown customers are kept with "-" (left outer join)
+class CityJoinMapper: public MapReduce::MapJoinMapper<std::string> {
+public:
+    virtual std::string getTableName() const { return "cities"; }
+
+    virtual void join(const std::string &key, const std::string &value, const std::string &city) {
+        emitIntermediate(key, value + " " + city);
+    }
+
+    virtual void unmatched(const std::string &key, const std::string &value) {
+        emitIntermediate(key, value + " -");
+    }
+};
+
+REGISTER_MAPPER(CityJoinMapper)
+
+std::map<std::string, std::string> toMap(const MapReduce::RecordVector &records) {
+    std::map<std::string, std::string> result;
+    for (const auto &record : records) {
+        BOOST_CHECK(result.insert(record.toPair()).second);
+    }
+    return result;
+}
+
+MapReduce::Specification makeWordCount(size_t mappers, size_t reducers) {
+    MapReduce::Specification spec;
+    spec.setMapper("WordCountMapper");
+    spec.setReducer("WordCountReducer");
+    spec.setMapperCount(mappers);
+    spec.setReducerCount(reducers);
+    return spec;
+}
+
+using Lines = std::vector<std::pair<std::string, std::string>>;
+
+// Lines of random words, a few of them frequent
+Lines makeText(size_t lineCount, unsigned seed) {
+    std::mt19937 random(seed);
+    Lines lines;
+    for (size_t i = 0; i < lineCount; ++i) {
+        std::string line;
+        size_t words = 1 + random() % 12;
+        for (size_t j = 0; j < words; ++j) {
+            size_t word = (random() % 4 == 0) ? random() % 5 : random() % 2000;
+            line += "w" + std::to_string(word) + " ";
+        }
+        lines.push_back(std::make_pair(std::to_string(i), line));
+    }
+    return lines;
+}
+
+bool isSortedByKey(const MapReduce::RecordVector &records) {
+    return std::is_sorted(records.begin(), records.end(), [] (const MapReduce::Record &a, const MapReduce::Record &b) {
+        return a.getKey() < b.getKey();
+    });
+}
+
+void appendLine(MapReduce::AppendableDataset &source, const std::string &line) {
+    source.append(std::to_string(source.getSize()), line);
+}
+
+std::shared_ptr<MapReduce::AppendableDataset> makeStreamSource() {
+    return std::make_shared<MapReduce::AppendableDataset>();
+}
+
+BOOST_AUTO_TEST_CASE(TumblingWindowTest) {
+    auto source = makeStreamSource();
+    MapReduce::StreamingComputation stream(makeWordCount(2, 2), source, MapReduce::WindowSpec::tumbling(2));
+    std::vector<MapReduce::WindowResult> windows;
+    const char *batches[] = {"a b", "a c", "b", "a"};
+    for (const char *line : batches) {
+        appendLine(*source, line);
+        BOOST_CHECK(stream.runBatch(windows));
+    }
+    BOOST_CHECK(!stream.runBatch(windows));
+    BOOST_REQUIRE_EQUAL(windows.size(), 2);
+    BOOST_CHECK_EQUAL(windows[0].getFirstBatch(), 0);
+    BOOST_CHECK_EQUAL(windows[0].getLastBatch(), 1);
+    std::map<std::string, std::string> first = {{"a", "2"}, {"b", "1"}, {"c", "1"}};
+    BOOST_CHECK(toMap(windows[0].getRecords()) == first);
+    BOOST_CHECK_EQUAL(windows[1].getFirstBatch(), 2);
+    BOOST_CHECK_EQUAL(windows[1].getLastBatch(), 3);
+    std::map<std::string, std::string> second = {{"a", "1"}, {"b", "1"}};
+    BOOST_CHECK(toMap(windows[1].getRecords()) == second);
+}
+
+BOOST_AUTO_TEST_CASE(SlidingWindowTest) {
+    auto source = makeStreamSource();
+    MapReduce::StreamingComputation stream(makeWordCount(2, 3), source, MapReduce::WindowSpec::sliding(2, 1));
+    std::vector<MapReduce::WindowResult> windows;
+    const char *batches[] = {"a b", "a c", "b", "a"};
+    for (const char *line : batches) {
+        appendLine(*source, line);
+        stream.runBatch(windows);
+    }
+    BOOST_REQUIRE_EQUAL(windows.size(), 4);
+    std::map<std::string, std::string> expected[] = {
+        {{"a", "1"}, {"b", "1"}},
+        {{"a", "2"}, {"b", "1"}, {"c", "1"}},
+        {{"a", "1"}, {"b", "1"}, {"c", "1"}},
+        {{"a", "1"}, {"b", "1"}}
+    };
+    for (size_t i = 0; i < windows.size(); ++i) {
+        BOOST_CHECK_EQUAL(windows[i].getFirstBatch(), (i == 0) ? 0 : i - 1);
+        BOOST_CHECK_EQUAL(windows[i].getLastBatch(), i);
+        BOOST_CHECK(toMap(windows[i].getRecords()) == expected[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MaxBatchSizeTest) {
+    auto source = makeStreamSource();
+    MapReduce::StreamingComputation stream(makeWordCount(1, 1), source);
+    stream.setMaxBatchSize(2);
+    for (int i = 0; i < 5; ++i) {
+        appendLine(*source, "w");
+    }
+    std::vector<MapReduce::WindowResult> windows;
+    while (stream.runBatch(windows)) { }
+    BOOST_CHECK_EQUAL(stream.getBatchCount(), 3);
+    BOOST_CHECK_EQUAL(stream.getOffset(), 5);
+    BOOST_REQUIRE_EQUAL(windows.size(), 3);
+    BOOST_CHECK_EQUAL(toMap(windows[0].getRecords())["w"], "2");
+    BOOST_CHECK_EQUAL(toMap(windows[1].getRecords())["w"], "2");
+    BOOST_CHECK_EQUAL(toMap(windows[2].getRecords())["w"], "1");
+}
+
+// Reducer emitting several records per key keeps all of them in a pane
+BOOST_AUTO_TEST_CASE(SeveralRecordsPerKeyTest) {
+    MapReduce::Specification spec;
+    spec.setMapper("PairMapper");
+    spec.setReducer("DistinctValuesReducer");
+    spec.setMapperCount(2);
+    spec.setReducerCount(2);
+    auto source = makeStreamSource();
+    MapReduce::StreamingComputation stream(spec, source, MapReduce::WindowSpec::tumbling(2));
+    std::vector<MapReduce::WindowResult> windows;
+    appendLine(*source, "x 1");
+    appendLine(*source, "x 2");
+    stream.runBatch(windows);
+    appendLine(*source, "x 2");
+    appendLine(*source, "x 3");
+    appendLine(*source, "y 4");
+    stream.runBatch(windows);
+    BOOST_REQUIRE_EQUAL(windows.size(), 1);
+    std::multimap<std::string, std::string> records;
+    for (const auto &record : windows[0].getRecords()) {
+        records.insert(record.toPair());
+    }
+    std::multimap<std::string, std::string> expected = {{"x", "1"}, {"x", "2"}, {"x", "3"}, {"y", "4"}};
+    BOOST_CHECK(records == expected);
+}
+
+BOOST_AUTO_TEST_CASE(MultiwayMergeIsStableTest) {
+    // Key and number of the run, compared by key only
+    using Item = std::pair<int, size_t>;
+    auto byKey = [] (const Item &a, const Item &b) { return a.first < b.first; };
+    std::mt19937 random(5);
+    std::vector<std::vector<Item>> data(6);
+    std::vector<Item> expected;
+    for (size_t r = 0; r < data.size(); ++r) {
+        for (size_t i = 0; i < 10000 + r * 1000; ++i) {
+            data[r].push_back(Item(static_cast<int>(random() % 3000), r));
+        }
+        std::sort(data[r].begin(), data[r].end());
+        expected.insert(expected.end(), data[r].begin(), data[r].end());
+    }
+    std::stable_sort(expected.begin(), expected.end(), byKey);
+
+    std::vector<MapReduce::SortedRun<std::vector<Item>::const_iterator>> runs;
+    for (const auto &run : data) {
+        runs.push_back(std::make_pair(run.cbegin(), run.cend()));
+    }
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        std::vector<Item> merged(expected.size());
+        MapReduce::multiwayMerge(runs, merged.begin(), threads, byKey);
+        BOOST_CHECK(merged == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SortedOutputTest) {
+    Lines text = makeText(3000, 11);
+    MapReduce::Specification spec = makeWordCount(4, 3);
+    spec.setDataset(MapReduce::makeDatasetFromContainer(text.begin(), text.end()));
+    MapReduce::RecordVector unsorted;
+    MapReduce::RunComputation(spec, unsorted);
+
+    spec.setSortedOutput(true);
+    MapReduce::RecordVector sorted;
+    MapReduce::RunComputation(spec, sorted);
+    BOOST_CHECK(isSortedByKey(sorted));
+    BOOST_CHECK(toMap(sorted) == toMap(unsorted));
+
+    // Most frequent words first. Reducers output keys in order and merge is
+    // stable in reducer order, so the result is the stable sort of unsorted output
+    MapReduce::RecordComparer byCount = [] (const MapReduce::Record &a, const MapReduce::Record &b) {
+        return std::atoi(a.getValue().c_str()) > std::atoi(b.getValue().c_str());
+    };
+    spec.setOutputComparer(byCount);
+    MapReduce::RecordVector records;
+    MapReduce::RunComputation(spec, records);
+    std::stable_sort(unsorted.begin(), unsorted.end(), byCount);
+    BOOST_REQUIRE_EQUAL(records.size(), unsorted.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        BOOST_CHECK(records[i].toPair() == unsorted[i].toPair());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MapOnlySortedOutputTest) {
+    Lines text = makeText(500, 13);
+    MapReduce::Specification spec;
+    spec.setMapper("WordCountMapper");
+    spec.setMapperCount(3);
+    spec.setMapOnly(true);
+    spec.setSortedOutput(true);
+    spec.setSorterCount(4);
+    spec.setDataset(MapReduce::makeDatasetFromContainer(text.begin(), text.end()));
+    MapReduce::RecordVector records;
+    MapReduce::RunComputation(spec, records);
+    BOOST_CHECK(isSortedByKey(records));
+    size_t words = 0;
+    for (const auto &line : text) {
+        std::istringstream stream(line.second);
+        std::string word;
+        while (stream >> word) {
+            ++words;
+        }
+    }
+    BOOST_CHECK_EQUAL(records.size(), words);
+}
+
+BOOST_AUTO_TEST_CASE(PartitionStoreSpillTest) {
+    MapReduce::PartitionStore store(std::make_shared<MapReduce::DefaultComparer>(), 3);
+    const char *records[][2] = {{"b", "1"}, {"a", "2"}, {"c", "3"}, {"a", "4"}, {"b", "5"},
+                                {"d", "6"}, {"a", "7"}};
+    for (const auto &record : records) {
+        store.add(MapReduce::Record(record[0], record[1]));
+    }
+    BOOST_CHECK_EQUAL(store.getSpillCount(), 2);
+    std::vector<std::pair<std::string, std::vector<std::string>>> groups;
+    store.forEachGroup([&groups] (const std::string &key, const std::vector<std::string> &values) {
+        groups.push_back(std::make_pair(key, values));
+    });
+    std::vector<std::pair<std::string, std::vector<std::string>>> expected = {
+        {"a", {"2", "4", "7"}}, {"b", {"1", "5"}}, {"c", {"3"}}, {"d", {"6"}}
+    };
+    BOOST_CHECK(groups == expected);
+}
+
+BOOST_AUTO_TEST_CASE(PipelinedMatchesBatchTest) {
+    Lines text = makeText(4000, 17);
+    MapReduce::Specification spec = makeWordCount(4, 3);
+    spec.setDataset(MapReduce::makeDatasetFromContainer(text.begin(), text.end()));
+    spec.setSortedOutput(true);
+    MapReduce::RecordVector expected;
+    MapReduce::RunComputation(spec, expected);
+    BOOST_CHECK(isSortedByKey(expected));
+
+    spec.setEmitBufferSize(64);
+    MapReduce::RecordVector pipelined;
+    MapReduce::RunComputation(spec, pipelined);
+    BOOST_REQUIRE_EQUAL(pipelined.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        BOOST_CHECK(pipelined[i].toPair() == expected[i].toPair());
+    }
+
+    // Partitions spill many sorted runs and reducers merge them
+    spec.setSpillThreshold(300);
+    MapReduce::RecordVector spilled;
+    MapReduce::RunComputation(spec, spilled);
+    BOOST_REQUIRE_EQUAL(spilled.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        BOOST_CHECK(spilled[i].toPair() == expected[i].toPair());
+    }
+}
+
+// Placement mode shuffles on reducers' nodes, result must be the same
+BOOST_AUTO_TEST_CASE(PlacementMatchesDefaultTest) {
+    Lines text = makeText(4000, 19);
+    MapReduce::Specification spec = makeWordCount(4, 3);
+    spec.setDataset(MapReduce::makeDatasetFromContainer(text.begin(), text.end()));
+    spec.setSortedOutput(true);
+    MapReduce::RecordVector expected;
+    MapReduce::RunComputation(spec, expected);
+
+    PlacementPolicy policies[] = {PlacementPolicy::Compact, PlacementPolicy::Scatter};
+    for (PlacementPolicy placement : policies) {
+        spec.setPlacementPolicy(placement);
+        MapReduce::RecordVector records;
+        MapReduce::RunComputation(spec, records);
+        BOOST_REQUIRE_EQUAL(records.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            BOOST_CHECK(records[i].toPair() == expected[i].toPair());
+        }
+        spec.setSortedOutput(false);
+        MapReduce::RunComputation(spec, records);
+        BOOST_CHECK(toMap(records) == toMap(expected));
+        spec.setSortedOutput(true);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PlacementMultiwayMergeTest) {
+    std::vector<std::vector<int>> data(4);
+    std::vector<int> expected;
+    std::mt19937 random(3);
+    for (auto &run : data) {
+        for (size_t i = 0; i < 20000; ++i) {
+            run.push_back(static_cast<int>(random() % 100000));
+        }
+        std::sort(run.begin(), run.end());
+        expected.insert(expected.end(), run.begin(), run.end());
+    }
+    std::sort(expected.begin(), expected.end());
+    std::vector<MapReduce::SortedRun<std::vector<int>::const_iterator>> runs;
+    for (const auto &run : data) {
+        runs.push_back(std::make_pair(run.cbegin(), run.cend()));
+    }
+    std::vector<int> merged(expected.size());
+    MapReduce::multiwayMerge(runs, merged.begin(), 4, std::less<int>(), PlacementPolicy::Scatter);
+    BOOST_CHECK(merged == expected);
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastTableTest) {
+    std::vector<std::pair<std::string, size_t>> pairs;
+    for (size_t i = 0; i < 1000; ++i) {
+        pairs.push_back(std::make_pair("k" + std::to_string(i), i));
+    }
+    MapReduce::BroadcastTable<size_t> table(pairs.begin(), pairs.end());
+    BOOST_CHECK_EQUAL(table.size(), pairs.size());
+    for (const auto &pair : pairs) {
+        BOOST_REQUIRE(table.find(pair.first));
+        BOOST_CHECK_EQUAL(*table.find(pair.first), pair.second);
+        BOOST_CHECK_EQUAL(table.get(pair.first), pair.second);
+    }
+    BOOST_CHECK(table.contains("k7"));
+    BOOST_CHECK(!table.contains("k1000"));
+    BOOST_CHECK(table.find("") == NULL);
+    BOOST_CHECK_THROW(table.get("k1000"), std::out_of_range);
+    BOOST_CHECK_EQUAL(static_cast<size_t>(std::distance(table.cbegin(), table.cend())), pairs.size());
+
+    std::vector<std::pair<std::string, size_t>> none;
+    MapReduce::BroadcastTable<size_t> empty(none.begin(), none.end());
+    BOOST_CHECK_EQUAL(empty.size(), 0);
+    BOOST_CHECK(empty.find("k1") == NULL);
+    BOOST_CHECK_THROW(empty.get("k1"), std::out_of_range);
+
+    pairs.push_back(std::make_pair("k500", 1));
+    BOOST_CHECK_THROW(MapReduce::BroadcastTable<size_t>(pairs.begin(), pairs.end()), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(BroadcastLookupTest) {
+    std::vector<std::pair<std::string, size_t>> pairs = {{"a", 1}, {"b", 2}};
+    MapReduce::Specification spec;
+    spec.addBroadcast<size_t>("counts", pairs.begin(), pairs.end());
+    BOOST_CHECK_EQUAL(spec.getBroadcast<size_t>("counts").get("b"), 2);
+    BOOST_CHECK_THROW(spec.getBroadcast<int>("counts"), std::runtime_error);
+    BOOST_CHECK_THROW(spec.getBroadcast<size_t>("missing"), std::runtime_error);
+    BOOST_CHECK_THROW(MapReduce::findBroadcast<size_t>(NULL, "counts"), std::runtime_error);
+    BOOST_CHECK_THROW(spec.addBroadcast<size_t>("counts", nullptr), std::invalid_argument);
+    spec.removeBroadcast("counts");
+    BOOST_CHECK_THROW(spec.getBroadcast<size_t>("counts"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(MapSideJoinTest) {
+    std::vector<std::pair<std::string, std::string>> cities;
+    for (size_t i = 0; i < 50; ++i) {
+        cities.push_back(std::make_pair("c" + std::to_string(i), "city" + std::to_string(i % 7)));
+    }
+    std::map<std::string, std::string> cityOf(cities.begin(), cities.end());
+    Lines orders;
+    std::mt19937 random(23);
+    for (size_t i = 0; i < 3000; ++i) {
+        orders.push_back(std::make_pair("c" + std::to_string(random() % 60), "o" + std::to_string(i)));
+    }
+    MapReduce::Specification spec;
+    spec.setMapper("CityJoinMapper");
+    spec.setMapperCount(4);
+    spec.setMapOnly(true);
+    spec.addBroadcast<std::string>("cities", cities.begin(), cities.end());
+    spec.setDataset(MapReduce::makeDatasetFromContainer(orders.begin(), orders.end()));
+    MapReduce::RecordVector records;
+    MapReduce::RunComputation(spec, records);
+
+    std::multiset<std::pair<std::string, std::string>> expected, joined;
+    for (const auto &order : orders) {
+        auto it = cityOf.find(order.first);
+        expected.insert(std::make_pair(order.first, order.second + " " +
+            (it != cityOf.end() ? it->second : std::string("-"))));
+    }
+    for (const auto &record : records) {
+        joined.insert(record.toPair());
+    }
+    BOOST_CHECK(joined == expected);
+}
@@ -4,6 +4,9 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
 
 // Минимальный класс для элемента кучи (ключ + приоритет)
 template<class _T, class _Priority>
@@ -52,6 +55,98 @@ public:
 
 template <class Key, class Value> using PQNodePtr = std::shared_ptr<IPriorityQueueNodePtr<Key, Value>>;
 
+// Дескриптор элемента без выделения памяти: номер слота и поколение слота.
+// Поколение увеличивается, когда элемент покидает очередь, поэтому старый
+// дескриптор недействителен, даже если слот снова занят. Проверка - одно
+// сравнение. Дескриптор относится только к очереди, которая его вернула
+// (и к ее копиям)
+struct PriorityQueueHandle {
+    PriorityQueueHandle():
+        index(UINT32_MAX),
+        generation(0)
+    { }
+
+    PriorityQueueHandle(uint32_t slotIndex, uint32_t slotGeneration):
+        index(slotIndex),
+        generation(slotGeneration)
+    { }
+
+    // Упаковка в одно число для IPriorityQueueNodePtr::getId
+    uint64_t pack() const { return (static_cast<uint64_t>(generation) << 32) | index; }
+
+    static PriorityQueueHandle unpack(uint64_t id) {
+        return PriorityQueueHandle(static_cast<uint32_t>(id), static_cast<uint32_t>(id >> 32));
+    }
+
+    bool operator== (const PriorityQueueHandle &rhs) const {
+        return index == rhs.index && generation == rhs.generation;
+    }
+
+    bool operator!= (const PriorityQueueHandle &rhs) const { return !(*this == rhs); }
+
+    uint32_t index;
+    uint32_t generation;
+};
+
+// Плотная таблица слотов для дескрипторов: слот хранит положение элемента в
+// куче (индекс в массиве или указатель на узел) и поколение. Освобожденные
+// слоты переиспользуются, так что таблица не больше максимального размера кучи
+template <class _Position>
+class PriorityQueueHandleTable {
+public:
+    PriorityQueueHandle acquire(const _Position &position) {
+        uint32_t index;
+        if (free_.empty()) {
+            if (slots_.size() == UINT32_MAX) {
+                throw std::length_error("too many elements for handles (PriorityQueueHandleTable::acquire)");
+            }
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.push_back(Slot(position));
+        } else {
+            index = free_.back();
+            free_.pop_back();
+            slots_[index].position = position;
+        }
+        return PriorityQueueHandle(index, slots_[index].generation);
+    }
+
+    void release(uint32_t index) {
+        ++slots_[index].generation;
+        free_.push_back(index);
+    }
+
+    bool isValid(const PriorityQueueHandle &handle) const {
+        return handle.index < slots_.size() && slots_[handle.index].generation == handle.generation;
+    }
+
+    _Position & operator[] (uint32_t index) { return slots_[index].position; }
+    const _Position & operator[] (uint32_t index) const { return slots_[index].position; }
+
+    // Освобождает все слоты, все выданные дескрипторы становятся недействительными
+    void clear() {
+        free_.clear();
+        for (size_t i = slots_.size(); i-- > 0; ) {
+            ++slots_[i].generation;
+            free_.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+private:
+    struct Slot {
+        explicit Slot(const _Position &slotPosition):
+            position(slotPosition),
+            generation(0)
+        { }
+
+        _Position position;
+        uint32_t generation;
+    };
+
+    std::vector<Slot> slots_;
+    // Свободные слоты, сверху - с меньшими номерами
+    std::vector<uint32_t> free_;
+};
+
 // Произвольная очередь с приоритетом
 // Компаратор работает также, как в куче из STL (...the element popped is the last according 
 // to strict weak ordering criterion...)
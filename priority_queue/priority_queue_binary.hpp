@@ -4,8 +4,6 @@
 
 #include <vector>
 #include <stdexcept>
-#include <map>
-#include <unordered_map>
 
 #include "priority_queue.hpp"
 
@@ -20,8 +18,9 @@ private:
     class PriorityQueueBinaryPtr: public IPriorityQueueNodePtr<_T, _Priority> {
     public:
         
-        PriorityQueueBinaryPtr(const PriorityQueueBinary<_T, _Priority, _Comp> *ptr, size_t id):
-            id_(id),
+        PriorityQueueBinaryPtr(const PriorityQueueBinary<_T, _Priority, _Comp> *ptr,
+                               const PriorityQueueHandle &handle):
+            handle_(handle),
             isHeapDestroyed_(ptr->heapDestroyed_),
             parent_(ptr)
         { }
@@ -31,24 +30,21 @@ private:
             if (!isValid()) {
                 throw std::runtime_error("binary heap node pointer is invalid");
             }
-            size_t realIndex = parent_->adr_.find(id_)->second;
-            return parent_->data_[realIndex];
+            return parent_->data_[parent_->handles_[handle_.index]];
         }
 
         virtual bool isValid() const {
-            return (*isHeapDestroyed_) == false &&
-                parent_->adr_.find(id_) != parent_->adr_.end() &&
-                parent_->adr_.find(id_)->second < parent_->data_.size();
+            return (*isHeapDestroyed_) == false && parent_->isValid(handle_);
         }
 
-        virtual size_t getId() const { return id_; }
+        virtual size_t getId() const { return handle_.pack(); }
 
         virtual const void *getParentPtr() const {
             return parent_;
         }
 
     private:
-        size_t id_;
+        PriorityQueueHandle handle_;
         std::shared_ptr<bool> isHeapDestroyed_;
         const PriorityQueueBinary<_T, _Priority, _Comp> *parent_;
     };
@@ -60,7 +56,6 @@ private:
 public:
 
     PriorityQueueBinary(const _Comp &compare = _Comp()): 
-        base_(0),
         comparer_(compare),
         heapDestroyed_(std::make_shared<bool>(false))
     { }
@@ -83,8 +78,7 @@ public:
     virtual void clear() {
         data_.clear();
         positions_.clear();
-        adr_.clear();
-        base_ = 0;
+        handles_.clear();
         // Делаем все старые указатели на элементы недействительными
         (*heapDestroyed_) = true;
         heapDestroyed_ = std::make_shared<bool>(false);
@@ -94,19 +88,24 @@ public:
     virtual bool empty() const { return data_.empty(); }
     virtual void updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority &newPriority);
 
+    // Дескрипторы вместо указателей: без выделения памяти и виртуальных вызовов
+    PriorityQueueHandle insertHandle(const _T &data, const _Priority &priority);
+    bool isValid(const PriorityQueueHandle &handle) const { return handles_.isValid(handle); }
+    const _NodeType & getNode(const PriorityQueueHandle &handle) const;
+    void updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority);
+
 private:
-    size_t base_;
     std::vector<_NodeType> data_; // Элементы кучи
     _Comp comparer_;
-    std::vector<size_t> positions_; // positions_: node_index (в векторе data_) -> unique_id
-    std::unordered_map<size_t, size_t> adr_; // adr_: unique_id -> node_index 
+    std::vector<uint32_t> positions_; // positions_: node_index (в векторе data_) -> слот дескриптора
+    PriorityQueueHandleTable<size_t> handles_; // handles_: слот дескриптора -> node_index
     std::shared_ptr<bool> heapDestroyed_;
 
     friend class PriorityQueueBinaryPtr;
 
     void swapNodes(size_t i, size_t j) {
         std::swap(data_[i], data_[j]);
-        std::swap(adr_[positions_[i]], adr_[positions_[j]]); 
+        std::swap(handles_[positions_[i]], handles_[positions_[j]]); 
         std::swap(positions_[i], positions_[j]); 
     }
    
@@ -5,12 +5,12 @@
 template <class _T, class  _Priority, class _Comp>
 PQBinary::PriorityQueueBinary(const std::vector<std::pair<_T, _Priority>> &items, 
                     const _Comp &compare) {
-    base_ = 0;
     comparer_ = compare;
     for (auto it = items.cbegin(); it != items.cend(); ++it) {
+        positions_.push_back(handles_.acquire(data_.size()).index);
         data_.push_back(PriorityQueueNode<_T, _Priority>(it->first, it->second));
     }
-    heapDestroyed_(std::make_shared<bool>(false));
+    heapDestroyed_ = std::make_shared<bool>(false);
     buildHeap();     
 }
 
@@ -18,9 +18,8 @@ template <class _T, class  _Priority, class _Comp>
 PQBinary::PriorityQueueBinary(const PQBinary &pq) {
     comparer_ = pq.comparer_;
     data_ = pq.data_;
-    base_ = pq.base_; 
     positions_ = pq.positions_;
-    adr_ = pq.adr_;
+    handles_ = pq.handles_;
     heapDestroyed_ = std::make_shared<bool>(false);
 }
 
@@ -29,30 +28,42 @@ PQBinary & PQBinary::operator= (const PQBinary &rhs) {
     if (&rhs != this) {
         comparer_ = rhs.comparer_;
         data_ = rhs.data_;
-        base_ = rhs.base_; 
         positions_ = rhs.positions_;
-        adr_ = rhs.adr_;
+        handles_ = rhs.handles_;
         (*heapDestroyed_) = true;
         heapDestroyed_ = std::make_shared<bool>(false);
     }
+    return *this;
 }
 
 template <class _T, class _Priority, class _Comp>
 std::shared_ptr<typename PQBinary::_BasePtr> PQBinary::insert(const _T &data, const _Priority &priority) {
-    size_t id = base_++;
+    return std::make_shared<_BinaryPtr>(this, insertHandle(data, priority));
+}
+
+template <class _T, class _Priority, class _Comp>
+PriorityQueueHandle PQBinary::insertHandle(const _T &data, const _Priority &priority) {
     size_t index = data_.size();
+    PriorityQueueHandle handle = handles_.acquire(index);
     data_.push_back(_NodeType(data, priority));
-    positions_.push_back(id);
-    adr_.emplace(id, index);
+    positions_.push_back(handle.index);
     siftUp(index);
-    return std::make_shared<_BinaryPtr>(this, id);
+    return handle;
+}
+
+template <class _T, class _Priority, class _Comp>
+const typename PQBinary::_NodeType & PQBinary::getNode(const PriorityQueueHandle &handle) const {
+    if (!isValid(handle)) {
+        throw std::runtime_error("binary heap handle is invalid");
+    }
+    return data_[handles_[handle.index]];
 }
 
 template <class _T, class _Priority, class _Comp>
 void PQBinary::extractTop() {
     swapNodes(0, data_.size() - 1);
     data_.pop_back();
-    adr_.erase(positions_.back());
+    handles_.release(positions_.back());
     positions_.pop_back();
     heapify(0);
 }
@@ -68,7 +79,15 @@ void PQBinary::updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority
     if (pointer->getParentPtr() != this) {
         throw std::runtime_error("update key error: invalid pointer");
     }
-    size_t dataIndex = adr_[pointer->getId()];
+    updatePriority(PriorityQueueHandle::unpack(pointer->getId()), newPriority);
+}
+
+template <class _T, class _Priority, class _Comp>
+void PQBinary::updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority) {
+    if (!isValid(handle)) {
+        throw std::runtime_error("update key error: invalid handle");
+    }
+    size_t dataIndex = handles_[handle.index];
     if (comparer_(newPriority, data_[dataIndex].getPriority())) {
         throw std::invalid_argument("update key error: bad new priority");
     }            
@@ -79,7 +98,8 @@ void PQBinary::updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority
 
 template <class _T, class _Priority, class _Comp>
 void PQBinary::buildHeap() {
-    for (size_t i = data_.size() / 2 - 1; i >= 0; --i) {
+    // size_t беззнаковый: условие i >= 0 выполнялось бы всегда
+    for (size_t i = data_.size() / 2; i-- > 0; ) {
         heapify(i);
     }
 }
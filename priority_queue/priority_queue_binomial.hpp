@@ -6,8 +6,6 @@
 #include <stdexcept>
 #include <vector>
 #include <list>
-#include <map>
-#include <unordered_map>
 #include <random>
 
 #include "priority_queue.hpp"
@@ -33,55 +31,52 @@ private:
         _NodePtr getSibling() const { return sibling_; }
         _NodePtr getChild() const { return child_; }
         size_t getDegree() const  { return degree_; }
-        size_t getId() const { return id_; }
+        uint32_t getId() const { return id_; }
 
         void setParent(_NodePtr newParent) { parent_ = newParent; }
         void setSibling(_NodePtr newSibling) { sibling_ = newSibling; }
         void setChild(_NodePtr newChild) { child_ = newChild; }
         void setDegree(size_t newDegree) { degree_ = newDegree; }
-        void setId(size_t newId) { id_ = newId; }
+        void setId(uint32_t newId) { id_ = newId; }
 
     private:
         _NodeWPtr parent_; 
         _NodePtr sibling_;
         _NodePtr child_;
         size_t degree_;
-        // Универсальный идентификатор для каждой ноды (может поменяться при swap при обновлении приоритета)
-        size_t id_; 
+        // Слот дескриптора (может поменяться при swap при обновлении приоритета)
+        uint32_t id_;
     };
 
     class PriorityQueueBinomialPtr: public IPriorityQueueNodePtr<_T, _Priority> {
     public:
 
-        PriorityQueueBinomialPtr(size_t id, const PriorityQueueBinomial<_T, _Priority, _Comp> *ptr):
-            id_(id),
+        PriorityQueueBinomialPtr(const PriorityQueueHandle &handle, const PriorityQueueBinomial<_T, _Priority, _Comp> *ptr):
+            handle_(handle),
             parent_(ptr),
             isHeapDestroyed_(ptr->heapDestroyed_)
         { }
 
-        void setId(size_t newId) { id_ = newId; }
-        
         // IPriorityQueueNodePtr implementation
         virtual const PriorityQueueNode<_T, _Priority> & getNode() const {
             if (!isValid()) {
                 throw std::runtime_error("binomial heap node pointer is expired");
             }
-            return *parent_->nodePtrs_.find(id_)->second.lock();
+            return *parent_->handles_[handle_.index];
         }
 
         virtual bool isValid() const {
-            return (*isHeapDestroyed_) == false && 
-                parent_->nodePtrs_.find(id_) != parent_->nodePtrs_.end();
+            return (*isHeapDestroyed_) == false && parent_->isValid(handle_);
         }
 
-        virtual size_t getId() const { return id_; }
+        virtual size_t getId() const { return handle_.pack(); }
 
         virtual const void *getParentPtr() const {
             return parent_;
         }
 
     private:
-        size_t id_;
+        PriorityQueueHandle handle_;
         const PriorityQueueBinomial<_T, _Priority, _Comp> *parent_; 
         std::shared_ptr<bool> isHeapDestroyed_;
     };
@@ -94,7 +89,6 @@ public:
     
     PriorityQueueBinomial(const _Comp &compare = _Comp()):
         size_(0),
-        base_(0),
         comparer_(compare),
         heapDestroyed_(std::make_shared<bool>(false))
     { }
@@ -113,9 +107,8 @@ public:
     
     virtual void clear() {
         head_.reset();
-        nodePtrs_.clear();
+        handles_.clear();
         size_ = 0;
-        base_ = 0;
         // Делаем все старые указатели на элементы недействительными
         (*heapDestroyed_) = true;
         heapDestroyed_ = std::make_shared<bool>(false);
@@ -125,12 +118,18 @@ public:
     virtual bool empty() const { return size_ == 0; }
     virtual void updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority &newPriority); 
 
+    // Дескрипторы вместо указателей: без выделения памяти под указатель
+    PriorityQueueHandle insertHandle(const _T &data, const _Priority &priority);
+    bool isValid(const PriorityQueueHandle &handle) const { return handles_.isValid(handle); }
+    const _NodeType & getNode(const PriorityQueueHandle &handle) const;
+    void updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority);
+
 private:
     size_t size_;
-    size_t base_;
     _Comp comparer_;
     std::shared_ptr<BinomialNode> head_;
-    std::unordered_map<size_t, _NodeWPtr> nodePtrs_;
+    // Слот дескриптора -> вершина, вершинами владеет дерево
+    PriorityQueueHandleTable<BinomialNode *> handles_;
     std::shared_ptr<bool> heapDestroyed_;
    
     friend class PriorityQueueBinomialPtr;
@@ -144,7 +143,8 @@ private:
 
     _NodePtr binomialHeapMerge(_NodePtr first, _NodePtr second);
     void binomialHeapUnionWithThis(_NodePtr heapHead);
-    // Копирует вершину, создавая новые указатели (используется в операторе = и конструкторе копирования)
+    // Копирует вершину под тем же слотом дескриптора (используется в операторе = и
+    // конструкторе копирования), таблица дескрипторов уже скопирована
     _NodePtr copyNode(_NodePtr node, _NodePtr parent);
 };
 
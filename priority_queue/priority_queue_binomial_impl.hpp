@@ -4,7 +4,7 @@
 
 template <class _T, class _Priority, class _Comp>
 PQBinomial::PriorityQueueBinomial(const PQBinomial &heap) {
-    base_ = 0;
+    handles_ = heap.handles_;
     head_ = copyNode(heap.head_, nullptr);
     size_ = heap.size_;
     comparer_ = heap.comparer_;
@@ -14,24 +14,37 @@ PQBinomial::PriorityQueueBinomial(const PQBinomial &heap) {
 template <class _T, class _Priority, class _Comp>
 PQBinomial & PQBinomial::operator= (const PQBinomial &rhs) {
     if (&rhs != this) {
-        base_ = 0;
+        handles_ = rhs.handles_;
         head_ = copyNode(rhs.head_, nullptr);
         size_ = rhs.size_;
         comparer_ = rhs.comparer_;
         (*heapDestroyed_) = true; 
         heapDestroyed_ = std::make_shared<bool>(false);
     }
+    return *this;
 }
 
 template <class _T, class _Priority, class _Comp>
 std::shared_ptr<typename PQBinomial::_BasePtr> PQBinomial::insert(const _T &data, const _Priority &priority) {
+    return std::make_shared<_BinomialPtr>(insertHandle(data, priority), this);
+}
+
+template <class _T, class _Priority, class _Comp>
+PriorityQueueHandle PQBinomial::insertHandle(const _T &data, const _Priority &priority) {
     _NodePtr node = std::make_shared<BinomialNode>(data, priority);
-    size_t id = base_++;
-    nodePtrs_[id] = node;
-    node->setId(id);
+    PriorityQueueHandle handle = handles_.acquire(node.get());
+    node->setId(handle.index);
     binomialHeapUnionWithThis(node);
     ++size_;
-    return std::make_shared<_BinomialPtr>(id, this);
+    return handle;
+}
+
+template <class _T, class _Priority, class _Comp>
+const typename PQBinomial::_NodeType & PQBinomial::getNode(const PriorityQueueHandle &handle) const {
+    if (!isValid(handle)) {
+        throw std::runtime_error("binomial heap handle is invalid");
+    }
+    return *handles_[handle.index];
 }
 
 template <class _T, class _Priority, class _Comp>
@@ -91,7 +104,7 @@ void PQBinomial::extractTop() {
     if (node) {
         binomialHeapUnionWithThis(node);
     }
-    nodePtrs_.erase(min->getId());
+    handles_.release(min->getId());
     --size_;
 }
 
@@ -103,24 +116,31 @@ void PQBinomial::updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priori
     if (pointer->getParentPtr() != this || !pointer->isValid()) {
         throw std::runtime_error("update key error: invalid pointer");
     }
-    _NodePtr node = nodePtrs_[pointer->getId()].lock();
-    if (comparer_(newPriority, node->getPriority())) {
+    updatePriority(PriorityQueueHandle::unpack(pointer->getId()), newPriority);
+}
+
+template <class _T, class _Priority, class _Comp>
+void PQBinomial::updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority) {
+    if (!isValid(handle)) {
+        throw std::runtime_error("update key error: invalid handle");
+    }
+    _NodePtr p = handles_[handle.index]->getParent();
+    BinomialNode *y = handles_[handle.index];
+    if (comparer_(newPriority, y->getPriority())) {
         throw std::invalid_argument("update key error: invalid new priority");
     }
-    node->setPriority(newPriority);
-    _NodePtr p = node->getParent();
-    _NodePtr y = node;
+    y->setPriority(newPriority);
     while (p && comparer_(p->getPriority(), y->getPriority())) {
         y->swap(*p); // Обмениваем содержимое вершин
         
-        // Обновляем указатели по универсальным идентификаторам
-        std::swap(nodePtrs_[y->getId()], nodePtrs_[p->getId()]);
+        // Обновляем слоты дескрипторов
+        std::swap(handles_[y->getId()], handles_[p->getId()]);
            
-        size_t pIndex = p->getId();
+        uint32_t pIndex = p->getId();
         p->setId(y->getId());
         y->setId(pIndex);
         
-        y = p;
+        y = p.get();
         p = y->getParent();
     }
 }
@@ -208,9 +228,8 @@ typename PQBinomial::_NodePtr PQBinomial::copyNode(_NodePtr node, _NodePtr paren
     result->setSibling(copyNode(node->getSibling(), parent));
     result->setDegree(node->getDegree());
     
-    size_t id = base_++; 
-    nodePtrs_[id] = result;
-    result->setId(id);
+    result->setId(node->getId());
+    handles_[node->getId()] = result.get();
     
     return result;
 }
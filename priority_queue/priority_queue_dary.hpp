@@ -0,0 +1,160 @@
+// priority_queue_dary.hpp
+#pragma once
+
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#include "priority_queue.hpp"
+
+// Аллокатор, выравнивающий память по границе кэш-линии
+template <class T>
+class CacheAlignedAllocator {
+public:
+    typedef T value_type;
+
+    static const size_t CacheLineSize = 64;
+
+    CacheAlignedAllocator() { }
+
+    template <class U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U> &) { }
+
+    T *allocate(size_t n) {
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, CacheLineSize, n * sizeof(T)) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t) { free(ptr); }
+
+    template <class U>
+    bool operator== (const CacheAlignedAllocator<U> &) const { return true; }
+
+    template <class U>
+    bool operator!= (const CacheAlignedAllocator<U> &) const { return false; }
+};
+
+// Очередь с приоритетом на D-арной куче. Дети узла i - элементы с номерами
+// D * i + 1 ... D * i + D. Перед корнем хранится D - 1 фиктивных элементов,
+// поэтому каждая группа детей начинается с индекса, кратного D, в выровненном
+// по кэш-линии массиве: при D * sizeof(узла) == 64 группа занимает ровно одну
+// линию. Просеивание двигает "дырку", а не меняет элементы местами, и
+// обновляет положение в таблице дескрипторов вместо хеш-таблицы
+template<class _T, class _Priority, class _Comp = std::less<_Priority>, size_t D = 4>
+class PriorityQueueDary: public IPriorityQueue<_T, _Priority, _Comp> {
+    static_assert(D >= 2, "D-ary heap needs D >= 2");
+
+private:
+
+    // HeapDestroyed: см. PriorityQueueBinary
+    class PriorityQueueDaryPtr: public IPriorityQueueNodePtr<_T, _Priority> {
+    public:
+
+        PriorityQueueDaryPtr(const PriorityQueueDary<_T, _Priority, _Comp, D> *ptr,
+                             const PriorityQueueHandle &handle):
+            handle_(handle),
+            isHeapDestroyed_(ptr->heapDestroyed_),
+            parent_(ptr)
+        { }
+
+        // IPriorityQueueNodePtr implementation
+        virtual const PriorityQueueNode<_T, _Priority> & getNode() const {
+            if (!isValid()) {
+                throw std::runtime_error("d-ary heap node pointer is invalid");
+            }
+            return parent_->data_[parent_->handles_[handle_.index]];
+        }
+
+        virtual bool isValid() const {
+            return (*isHeapDestroyed_) == false && parent_->isValid(handle_);
+        }
+
+        virtual size_t getId() const { return handle_.pack(); }
+
+        virtual const void *getParentPtr() const {
+            return parent_;
+        }
+
+    private:
+        PriorityQueueHandle handle_;
+        std::shared_ptr<bool> isHeapDestroyed_;
+        const PriorityQueueDary<_T, _Priority, _Comp, D> *parent_;
+    };
+
+    typedef PriorityQueueNode<_T, _Priority> _NodeType;
+    typedef IPriorityQueueNodePtr<_T, _Priority> _BasePtr;
+    typedef PriorityQueueDaryPtr _DaryPtr;
+
+    // Число фиктивных элементов перед корнем
+    static const size_t Offset = D - 1;
+
+public:
+
+    PriorityQueueDary(const _Comp &compare = _Comp()):
+        data_(Offset),
+        comparer_(compare),
+        heapDestroyed_(std::make_shared<bool>(false))
+    { }
+
+    PriorityQueueDary(const std::vector<std::pair<_T, _Priority>> &items,
+                      const _Comp &compare = _Comp());
+    PriorityQueueDary(const PriorityQueueDary &pq);
+
+    ~PriorityQueueDary() {
+        (*heapDestroyed_) = true;
+    }
+
+    PriorityQueueDary & operator= (const PriorityQueueDary &rhs);
+
+    // IPriorityQueue implementation
+    virtual std::shared_ptr<_BasePtr> insert(const _T &data, const _Priority &priority);
+    virtual const _NodeType & getTop() const { return data_[Offset]; }
+    virtual void extractTop();
+
+    virtual void clear() {
+        data_.resize(Offset);
+        slots_.clear();
+        handles_.clear();
+        // Делаем все старые указатели на элементы недействительными
+        (*heapDestroyed_) = true;
+        heapDestroyed_ = std::make_shared<bool>(false);
+    }
+
+    virtual size_t size() const { return slots_.size(); }
+    virtual bool empty() const { return slots_.empty(); }
+    virtual void updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority &newPriority);
+
+    // Дескрипторы вместо указателей: без выделения памяти и виртуальных вызовов
+    PriorityQueueHandle insertHandle(const _T &data, const _Priority &priority);
+    bool isValid(const PriorityQueueHandle &handle) const { return handles_.isValid(handle); }
+    const _NodeType & getNode(const PriorityQueueHandle &handle) const;
+    void updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority);
+
+private:
+    // data_[Offset + i] - i-й элемент кучи
+    std::vector<_NodeType, CacheAlignedAllocator<_NodeType>> data_;
+    _Comp comparer_;
+    std::vector<uint32_t> slots_; // slots_: индекс в куче -> слот дескриптора
+    PriorityQueueHandleTable<size_t> handles_; // handles_: слот дескриптора -> индекс в data_
+    std::shared_ptr<bool> heapDestroyed_;
+
+    friend class PriorityQueueDaryPtr;
+
+    // Кладет элемент в позицию i (индекс в куче)
+    void place(size_t i, _NodeType &&node, uint32_t slot) {
+        data_[Offset + i] = std::move(node);
+        slots_[i] = slot;
+        handles_[slot] = Offset + i;
+    }
+
+    void buildHeap();
+    void siftUp(size_t i);
+    void siftDown(size_t i);
+};
+
+#include "priority_queue_dary_impl.hpp"
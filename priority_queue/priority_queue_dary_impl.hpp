@@ -0,0 +1,158 @@
+// priority_queue_dary_impl.hpp
+#define PQDary PriorityQueueDary<_T, _Priority, _Comp, D>
+
+template <class _T, class _Priority, class _Comp, size_t D>
+PQDary::PriorityQueueDary(const std::vector<std::pair<_T, _Priority>> &items,
+                    const _Comp &compare):
+    data_(Offset),
+    comparer_(compare),
+    heapDestroyed_(std::make_shared<bool>(false))
+{
+    data_.reserve(Offset + items.size());
+    for (auto it = items.cbegin(); it != items.cend(); ++it) {
+        slots_.push_back(handles_.acquire(data_.size()).index);
+        data_.push_back(_NodeType(it->first, it->second));
+    }
+    buildHeap();
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+PQDary::PriorityQueueDary(const PQDary &pq):
+    data_(pq.data_),
+    comparer_(pq.comparer_),
+    slots_(pq.slots_),
+    handles_(pq.handles_),
+    heapDestroyed_(std::make_shared<bool>(false))
+{ }
+
+template <class _T, class _Priority, class _Comp, size_t D>
+PQDary & PQDary::operator= (const PQDary &rhs) {
+    if (&rhs != this) {
+        comparer_ = rhs.comparer_;
+        data_ = rhs.data_;
+        slots_ = rhs.slots_;
+        handles_ = rhs.handles_;
+        (*heapDestroyed_) = true;
+        heapDestroyed_ = std::make_shared<bool>(false);
+    }
+    return *this;
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+std::shared_ptr<typename PQDary::_BasePtr> PQDary::insert(const _T &data, const _Priority &priority) {
+    return std::make_shared<_DaryPtr>(this, insertHandle(data, priority));
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+PriorityQueueHandle PQDary::insertHandle(const _T &data, const _Priority &priority) {
+    PriorityQueueHandle handle = handles_.acquire(data_.size());
+    slots_.push_back(handle.index);
+    data_.push_back(_NodeType(data, priority));
+    siftUp(slots_.size() - 1);
+    return handle;
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+const typename PQDary::_NodeType & PQDary::getNode(const PriorityQueueHandle &handle) const {
+    if (!isValid(handle)) {
+        throw std::runtime_error("d-ary heap handle is invalid");
+    }
+    return data_[handles_[handle.index]];
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+void PQDary::extractTop() {
+    handles_.release(slots_[0]);
+    size_t last = slots_.size() - 1;
+    if (last > 0) {
+        // Последний элемент опускается из корня
+        place(0, std::move(data_.back()), slots_[last]);
+    }
+    data_.pop_back();
+    slots_.pop_back();
+    if (last > 1) {
+        siftDown(0);
+    }
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+void PQDary::updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority &newPriority) {
+    if (!pointer) {
+        throw std::runtime_error("update key error: null pointer");
+    }
+    if (!pointer->isValid()) {
+        throw std::runtime_error("update key error: invalid pointer");
+    }
+    if (pointer->getParentPtr() != this) {
+        throw std::runtime_error("update key error: invalid pointer");
+    }
+    updatePriority(PriorityQueueHandle::unpack(pointer->getId()), newPriority);
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+void PQDary::updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority) {
+    if (!isValid(handle)) {
+        throw std::runtime_error("update key error: invalid handle");
+    }
+    size_t dataIndex = handles_[handle.index];
+    if (comparer_(newPriority, data_[dataIndex].getPriority())) {
+        throw std::invalid_argument("update key error: bad new priority");
+    }
+    data_[dataIndex].setPriority(newPriority);
+    siftUp(dataIndex - Offset);
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+void PQDary::buildHeap() {
+    if (slots_.size() < 2) {
+        return;
+    }
+    // Начинаем с родителя последнего элемента
+    for (size_t i = (slots_.size() - 2) / D + 1; i-- > 0; ) {
+        siftDown(i);
+    }
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+void PQDary::siftUp(size_t i) {
+    _NodeType node = std::move(data_[Offset + i]);
+    uint32_t slot = slots_[i];
+    while (i > 0) {
+        size_t p = (i - 1) / D;
+        if (!comparer_(data_[Offset + p].getPriority(), node.getPriority())) {
+            break;
+        }
+        place(i, std::move(data_[Offset + p]), slots_[p]);
+        i = p;
+    }
+    place(i, std::move(node), slot);
+}
+
+template <class _T, class _Priority, class _Comp, size_t D>
+void PQDary::siftDown(size_t i) {
+    size_t count = slots_.size();
+    _NodeType node = std::move(data_[Offset + i]);
+    uint32_t slot = slots_[i];
+    while (true) {
+        size_t first = D * i + 1;
+        if (first >= count) {
+            break;
+        }
+        // Все дети лежат подряд, выбираем лучшего из них
+        size_t last = std::min(first + D, count);
+        size_t best = first;
+        for (size_t c = first + 1; c < last; ++c) {
+            if (comparer_(data_[Offset + best].getPriority(), data_[Offset + c].getPriority())) {
+                best = c;
+            }
+        }
+        if (!comparer_(node.getPriority(), data_[Offset + best].getPriority())) {
+            break;
+        }
+        place(i, std::move(data_[Offset + best]), slots_[best]);
+        i = best;
+    }
+    place(i, std::move(node), slot);
+}
+
+#undef PQDary
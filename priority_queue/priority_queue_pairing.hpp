@@ -0,0 +1,327 @@
+// priority_queue_pairing.hpp
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#include "priority_queue.hpp"
+
+// Пул узлов: узлы выделяются блоками по BlockSize, освобожденный узел не
+// уничтожается, а переиспользуется. Память узла доступна до уничтожения
+// пула, адрес узла не меняется. Номер узла - номер блока * BlockSize +
+// смещение в блоке, у каждого узла есть поколение, так что номер и
+// поколение образуют дескриптор. При слиянии пулов меняются только номера
+// блоков. T должен иметь конструктор по умолчанию
+template <class T, size_t BlockSize = 1024>
+class NodePool {
+private:
+    struct Slot {
+        T node;
+        uint32_t generation;
+    };
+
+    struct Block {
+        Block(uint32_t blockNumber, uint32_t generation):
+            slots(new Slot[BlockSize]),
+            number(blockNumber)
+        {
+            for (size_t i = 0; i < BlockSize; ++i) {
+                slots[i].generation = generation;
+            }
+        }
+
+        std::unique_ptr<Slot[]> slots;
+        uint32_t number;
+    };
+
+public:
+    NodePool():
+        used_(BlockSize),
+        generationFloor_(0),
+        maxGeneration_(0)
+    { }
+
+    NodePool(const NodePool &rhs):
+        used_(rhs.used_),
+        generationFloor_(rhs.generationFloor_),
+        maxGeneration_(rhs.maxGeneration_)
+    {
+        for (const auto &block : rhs.blocks_) {
+            blocks_.emplace_back(new Block(block->number, 0));
+            std::copy(block->slots.get(), block->slots.get() + BlockSize, blocks_.back()->slots.get());
+        }
+        for (const auto &slot : rhs.free_) {
+            free_.push_back(std::make_pair(blocks_[slot.first->number].get(), slot.second));
+        }
+    }
+
+    NodePool & operator= (const NodePool &rhs) = delete;
+
+    void swap(NodePool &other) {
+        blocks_.swap(other.blocks_);
+        free_.swap(other.free_);
+        std::swap(used_, other.used_);
+        std::swap(generationFloor_, other.generationFloor_);
+        std::swap(maxGeneration_, other.maxGeneration_);
+    }
+
+    static uint32_t makeIndex(uint32_t blockNumber, uint32_t offset) {
+        return static_cast<uint32_t>(blockNumber * BlockSize + offset);
+    }
+
+    static uint32_t getOffset(uint32_t index) { return index % BlockSize; }
+
+    PriorityQueueHandle acquire() {
+        uint32_t index;
+        if (!free_.empty()) {
+            index = makeIndex(free_.back().first->number, free_.back().second);
+            free_.pop_back();
+        } else {
+            if (used_ == BlockSize) {
+                if (blocks_.size() >= UINT32_MAX / BlockSize) {
+                    throw std::length_error("too many nodes (NodePool::acquire)");
+                }
+                blocks_.emplace_back(new Block(static_cast<uint32_t>(blocks_.size()), generationFloor_));
+                used_ = 0;
+            }
+            index = makeIndex(blocks_.back()->number, static_cast<uint32_t>(used_++));
+        }
+        return PriorityQueueHandle(index, getSlot(index).generation);
+    }
+
+    void release(uint32_t index) {
+        uint32_t generation = ++getSlot(index).generation;
+        maxGeneration_ = std::max(maxGeneration_, generation);
+        free_.push_back(std::make_pair(blocks_[index / BlockSize].get(), getOffset(index)));
+    }
+
+    bool isValid(const PriorityQueueHandle &handle) const {
+        return handle.index < blocks_.size() * BlockSize &&
+            getSlot(handle.index).generation == handle.generation;
+    }
+
+    T & operator[] (uint32_t index) { return getSlot(index).node; }
+    const T & operator[] (uint32_t index) const { return getSlot(index).node; }
+
+    // Номер блока узла, меняется при слиянии пулов. Адрес постоянный
+    const uint32_t & getBlockNumber(uint32_t index) const { return blocks_[index / BlockSize]->number; }
+
+    // Забирает все узлы другого пула за O(число блоков и свободных узлов other).
+    // Остаток последнего блока этого пула уходит в список свободных
+    void splice(NodePool &other) {
+        if (blocks_.size() + other.blocks_.size() > UINT32_MAX / BlockSize) {
+            throw std::length_error("too many nodes (NodePool::splice)");
+        }
+        if (!other.blocks_.empty()) {
+            for (size_t i = used_; i < BlockSize; ++i) {
+                free_.push_back(std::make_pair(blocks_.back().get(), static_cast<uint32_t>(i)));
+            }
+            used_ = other.used_;
+        }
+        for (auto &block : other.blocks_) {
+            block->number = static_cast<uint32_t>(blocks_.size());
+            blocks_.push_back(std::move(block));
+        }
+        free_.insert(free_.end(), other.free_.begin(), other.free_.end());
+        maxGeneration_ = std::max(maxGeneration_, other.maxGeneration_);
+        generationFloor_ = std::max(generationFloor_, other.generationFloor_);
+        other.reset();
+    }
+
+    // Освобождает все узлы. Новые узлы получают поколения больше всех
+    // выданных, так что старые дескрипторы остаются недействительными
+    void reset() {
+        blocks_.clear();
+        free_.clear();
+        used_ = BlockSize;
+        generationFloor_ = maxGeneration_ + 1;
+        maxGeneration_ = generationFloor_;
+    }
+
+private:
+    Slot & getSlot(uint32_t index) { return blocks_[index / BlockSize]->slots[index % BlockSize]; }
+    const Slot & getSlot(uint32_t index) const { return blocks_[index / BlockSize]->slots[index % BlockSize]; }
+
+    std::vector<std::unique_ptr<Block>> blocks_;
+    // Свободные узлы: блок и смещение в нем
+    std::vector<std::pair<Block *, uint32_t>> free_;
+    // Занято в последнем блоке
+    size_t used_;
+    // Начальное поколение узлов новых блоков
+    uint32_t generationFloor_;
+    uint32_t maxGeneration_;
+};
+
+// Очередь с приоритетом на паросочетающейся (pairing) куче. insert и meld за
+// O(1), извлечение вершины - двухпроходное слияние детей корня за O(log n)
+// амортизированно. Обновление приоритета вырезает поддерево узла и сливает
+// его с корнем: O(1) плюс амортизированная доплата при следующем
+// извлечении, на графовых задачах почти всегда быстрее бинарной кучи. Узлы
+// берутся из пула, дескриптор элемента - номер узла в пуле и его поколение
+template<class _T, class _Priority, class _Comp = std::less<_Priority>>
+class PriorityQueuePairing: public IPriorityQueue<_T, _Priority, _Comp> {
+private:
+
+    class PairingNode: public PriorityQueueNode<_T, _Priority> {
+    public:
+
+        PairingNode():
+            child_(nullptr),
+            sibling_(nullptr),
+            prev_(nullptr),
+            blockNumber_(nullptr),
+            offset_(0)
+        { }
+
+        PairingNode *child_;
+        PairingNode *sibling_;
+        // Родитель для самого левого ребенка, иначе левый брат
+        PairingNode *prev_;
+        // Номер узла в пуле: номер блока и смещение в блоке
+        const uint32_t *blockNumber_;
+        uint32_t offset_;
+    };
+
+    // HeapDestroyed: см. PriorityQueueBinary
+    class PriorityQueuePairingPtr: public IPriorityQueueNodePtr<_T, _Priority> {
+    public:
+
+        PriorityQueuePairingPtr(const PriorityQueuePairing<_T, _Priority, _Comp> *ptr,
+                                const PriorityQueueHandle &handle):
+            handle_(handle),
+            isHeapDestroyed_(ptr->heapDestroyed_),
+            parent_(ptr)
+        { }
+
+        // IPriorityQueueNodePtr implementation
+        virtual const PriorityQueueNode<_T, _Priority> & getNode() const {
+            if (!isValid()) {
+                throw std::runtime_error("pairing heap node pointer is invalid");
+            }
+            return parent_->pool_[handle_.index];
+        }
+
+        virtual bool isValid() const {
+            return (*isHeapDestroyed_) == false && parent_->isValid(handle_);
+        }
+
+        virtual size_t getId() const { return handle_.pack(); }
+
+        virtual const void *getParentPtr() const {
+            return parent_;
+        }
+
+    private:
+        PriorityQueueHandle handle_;
+        std::shared_ptr<bool> isHeapDestroyed_;
+        const PriorityQueuePairing<_T, _Priority, _Comp> *parent_;
+    };
+
+    typedef PriorityQueueNode<_T, _Priority> _NodeType;
+    typedef IPriorityQueueNodePtr<_T, _Priority> _BasePtr;
+    typedef PriorityQueuePairingPtr _PairingPtr;
+
+public:
+
+    PriorityQueuePairing(const _Comp &compare = _Comp()):
+        root_(nullptr),
+        size_(0),
+        comparer_(compare),
+        heapDestroyed_(std::make_shared<bool>(false))
+    { }
+
+    PriorityQueuePairing(const PriorityQueuePairing &heap);
+
+    ~PriorityQueuePairing() {
+        (*heapDestroyed_) = true;
+    }
+
+    PriorityQueuePairing & operator= (const PriorityQueuePairing &rhs);
+
+    // IPriorityQueue implementation
+    virtual std::shared_ptr<_BasePtr> insert(const _T &data, const _Priority &priority);
+    virtual const _NodeType & getTop() const;
+    virtual void extractTop();
+
+    virtual void clear() {
+        root_ = nullptr;
+        size_ = 0;
+        pool_.reset();
+        // Делаем все старые указатели на элементы недействительными
+        (*heapDestroyed_) = true;
+        heapDestroyed_ = std::make_shared<bool>(false);
+    }
+
+    virtual size_t size() const { return size_; }
+    virtual bool empty() const { return size_ == 0; }
+    virtual void updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority &newPriority);
+
+    // Дескрипторы вместо указателей: без выделения памяти и виртуальных вызовов
+    PriorityQueueHandle insertHandle(const _T &data, const _Priority &priority);
+    bool isValid(const PriorityQueueHandle &handle) const { return pool_.isValid(handle); }
+    const _NodeType & getNode(const PriorityQueueHandle &handle) const;
+    void updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority);
+
+    // Переносит все элементы heap в эту кучу за O(1) (плюс число блоков и
+    // свободных узлов пула), heap становится пустой. Указатели и дескрипторы
+    // элементов heap становятся недействительными
+    void meld(PriorityQueuePairing &heap);
+
+private:
+    PairingNode *root_;
+    size_t size_;
+    _Comp comparer_;
+    NodePool<PairingNode> pool_;
+    // Буфер для слияния детей в extractTop
+    std::vector<PairingNode *> pairs_;
+    std::shared_ptr<bool> heapDestroyed_;
+
+    friend class PriorityQueuePairingPtr;
+
+    // Сливает два дерева, корень с худшим приоритетом становится самым левым ребенком
+    PairingNode *link(PairingNode *first, PairingNode *second) {
+        if (comparer_(first->getPriority(), second->getPriority())) {
+            std::swap(first, second);
+        }
+        second->sibling_ = first->child_;
+        if (first->child_) {
+            first->child_->prev_ = second;
+        }
+        second->prev_ = first;
+        first->child_ = second;
+        return first;
+    }
+
+    // Вырезает поддерево узла (не корня) из списка детей его родителя
+    void cut(PairingNode *node) {
+        if (node->prev_->child_ == node) {
+            node->prev_->child_ = node->sibling_;
+        } else {
+            node->prev_->sibling_ = node->sibling_;
+        }
+        if (node->sibling_) {
+            node->sibling_->prev_ = node->prev_;
+        }
+        node->prev_ = nullptr;
+        node->sibling_ = nullptr;
+    }
+
+    PairingNode *mergePairs(PairingNode *first);
+    // Узлы копии лежат в пуле копии под теми же номерами, что и в исходной
+    // куче, так что дескрипторы исходной кучи действуют и в копии
+    PairingNode *translate(const PairingNode *node) {
+        return node ? &pool_[getIndex(node)] : nullptr;
+    }
+
+    static uint32_t getIndex(const PairingNode *node) {
+        return NodePool<PairingNode>::makeIndex(*node->blockNumber_, node->offset_);
+    }
+
+    PairingNode *copyLinks(const PairingNode *root);
+};
+
+#include "priority_queue_pairing_impl.hpp"
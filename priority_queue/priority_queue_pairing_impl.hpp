@@ -0,0 +1,171 @@
+// priority_queue_pairing_impl.hpp
+#define PQPairing PriorityQueuePairing<_T, _Priority, _Comp>
+
+template <class _T, class _Priority, class _Comp>
+PQPairing::PriorityQueuePairing(const PQPairing &heap):
+    root_(nullptr),
+    size_(heap.size_),
+    comparer_(heap.comparer_),
+    pool_(heap.pool_),
+    heapDestroyed_(std::make_shared<bool>(false))
+{
+    root_ = copyLinks(heap.root_);
+}
+
+template <class _T, class _Priority, class _Comp>
+PQPairing & PQPairing::operator= (const PQPairing &rhs) {
+    if (&rhs != this) {
+        PQPairing copy(rhs);
+        std::swap(root_, copy.root_);
+        std::swap(size_, copy.size_);
+        std::swap(comparer_, copy.comparer_);
+        pool_.swap(copy.pool_);
+        (*heapDestroyed_) = true;
+        heapDestroyed_ = std::make_shared<bool>(false);
+    }
+    return *this;
+}
+
+template <class _T, class _Priority, class _Comp>
+std::shared_ptr<typename PQPairing::_BasePtr> PQPairing::insert(const _T &data, const _Priority &priority) {
+    return std::make_shared<_PairingPtr>(this, insertHandle(data, priority));
+}
+
+template <class _T, class _Priority, class _Comp>
+PriorityQueueHandle PQPairing::insertHandle(const _T &data, const _Priority &priority) {
+    PriorityQueueHandle handle = pool_.acquire();
+    PairingNode *node = &pool_[handle.index];
+    node->setKey(data);
+    node->setPriority(priority);
+    node->child_ = node->sibling_ = node->prev_ = nullptr;
+    node->blockNumber_ = &pool_.getBlockNumber(handle.index);
+    node->offset_ = NodePool<PairingNode>::getOffset(handle.index);
+    root_ = root_ ? link(root_, node) : node;
+    ++size_;
+    return handle;
+}
+
+template <class _T, class _Priority, class _Comp>
+const typename PQPairing::_NodeType & PQPairing::getNode(const PriorityQueueHandle &handle) const {
+    if (!isValid(handle)) {
+        throw std::runtime_error("pairing heap handle is invalid");
+    }
+    return pool_[handle.index];
+}
+
+template <class _T, class _Priority, class _Comp>
+const PriorityQueueNode<_T, _Priority> & PQPairing::getTop() const {
+    if (!root_) {
+        throw std::runtime_error("getTop error: pairing heap is empty");
+    }
+    return *root_;
+}
+
+template <class _T, class _Priority, class _Comp>
+void PQPairing::extractTop() {
+    if (!root_) {
+        throw std::runtime_error("extractTop error: pairing heap is empty");
+    }
+    PairingNode *top = root_;
+    root_ = mergePairs(top->child_);
+    top->child_ = nullptr;
+    pool_.release(getIndex(top));
+    --size_;
+}
+
+template <class _T, class _Priority, class _Comp>
+void PQPairing::updatePriority(std::shared_ptr<_BasePtr> pointer, const _Priority &newPriority) {
+    if (!pointer) {
+        throw std::runtime_error("update key error: null pointer");
+    }
+    if (!pointer->isValid()) {
+        throw std::runtime_error("update key error: invalid pointer");
+    }
+    if (pointer->getParentPtr() != this) {
+        throw std::runtime_error("update key error: invalid pointer");
+    }
+    updatePriority(PriorityQueueHandle::unpack(pointer->getId()), newPriority);
+}
+
+template <class _T, class _Priority, class _Comp>
+void PQPairing::updatePriority(const PriorityQueueHandle &handle, const _Priority &newPriority) {
+    if (!isValid(handle)) {
+        throw std::runtime_error("update key error: invalid handle");
+    }
+    PairingNode *node = &pool_[handle.index];
+    if (comparer_(newPriority, node->getPriority())) {
+        throw std::invalid_argument("update key error: bad new priority");
+    }
+    node->setPriority(newPriority);
+    if (node != root_) {
+        cut(node);
+        root_ = link(root_, node);
+    }
+}
+
+template <class _T, class _Priority, class _Comp>
+void PQPairing::meld(PQPairing &heap) {
+    if (&heap == this || !heap.root_) {
+        return;
+    }
+    PairingNode *other = heap.root_;
+    pool_.splice(heap.pool_);
+    root_ = root_ ? link(root_, other) : other;
+    size_ += heap.size_;
+    heap.root_ = nullptr;
+    heap.size_ = 0;
+    (*heap.heapDestroyed_) = true;
+    heap.heapDestroyed_ = std::make_shared<bool>(false);
+}
+
+// Первый проход сливает детей попарно слева направо, второй - результаты
+// справа налево
+template <class _T, class _Priority, class _Comp>
+typename PQPairing::PairingNode *PQPairing::mergePairs(PairingNode *first) {
+    if (!first) {
+        return nullptr;
+    }
+    pairs_.clear();
+    while (first) {
+        PairingNode *a = first;
+        PairingNode *b = a->sibling_;
+        first = b ? b->sibling_ : nullptr;
+        a->prev_ = a->sibling_ = nullptr;
+        if (b) {
+            b->prev_ = b->sibling_ = nullptr;
+            pairs_.push_back(link(a, b));
+        } else {
+            pairs_.push_back(a);
+        }
+    }
+    PairingNode *result = pairs_.back();
+    for (size_t i = pairs_.size() - 1; i-- > 0; ) {
+        result = link(pairs_[i], result);
+    }
+    return result;
+}
+
+// Пул уже скопирован, узлы копии указывают в пул исходной кучи. Без
+// рекурсии: после многих insert у корня может быть очень много детей
+template <class _T, class _Priority, class _Comp>
+typename PQPairing::PairingNode *PQPairing::copyLinks(const PairingNode *root) {
+    if (!root) {
+        return nullptr;
+    }
+    std::vector<const PairingNode *> stack(1, root);
+    while (!stack.empty()) {
+        const PairingNode *source = stack.back();
+        stack.pop_back();
+        PairingNode *copy = translate(source);
+        copy->blockNumber_ = &pool_.getBlockNumber(getIndex(source));
+        copy->child_ = translate(source->child_);
+        copy->sibling_ = translate(source->sibling_);
+        copy->prev_ = translate(source->prev_);
+        for (const PairingNode *child = source->child_; child; child = child->sibling_) {
+            stack.push_back(child);
+        }
+    }
+    return translate(root);
+}
+
+#undef PQPairing
@@ -8,10 +8,13 @@
 #include <chrono>
 #include <queue>
 #include <stdexcept>
+#include <limits>
 
 #define DEBUG
 #include "priority_queue_binary.hpp"
 #include "priority_queue_binomial.hpp"
+#include "priority_queue_dary.hpp"
+#include "priority_queue_pairing.hpp"
 
 std::default_random_engine generator;
 
@@ -55,14 +58,90 @@ BOOST_AUTO_TEST_CASE(BinomialHeapCorrectnessTest) {
     correctnessTest<PriorityQueueBinomial<int, int>>();
 }
 
+BOOST_AUTO_TEST_CASE(DaryHeapCorrectnessTest) {
+    correctnessTest<PriorityQueueDary<int, int>>();
+    correctnessTest<PriorityQueueDary<int, int, std::less<int>, 8>>();
+}
+
+BOOST_AUTO_TEST_CASE(PairingHeapCorrectnessTest) {
+    correctnessTest<PriorityQueuePairing<int, int>>();
+}
+
+// Построение кучи из вектора элементов
+template <typename Heap>
+void buildHeapTest() {
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < 1000; ++i) {
+        items.push_back(std::make_pair(i, (i * 7919) % 1000));
+    }
+    Heap heap(items);
+    BOOST_CHECK_EQUAL(heap.size(), items.size());
+    for (int priority = 999; priority >= 0; --priority) {
+        BOOST_CHECK_EQUAL(heap.getTop().getPriority(), priority);
+        BOOST_CHECK_EQUAL((heap.getTop().getKey() * 7919) % 1000, priority);
+        heap.extractTop();
+    }
+    BOOST_CHECK(heap.empty());
+
+    Heap single(std::vector<std::pair<int, int>>(1, std::make_pair(1, 2)));
+    BOOST_CHECK_EQUAL(single.getTop().getKey(), 1);
+    Heap none(std::vector<std::pair<int, int>>{});
+    BOOST_CHECK(none.empty());
+}
+
+BOOST_AUTO_TEST_CASE(BinaryHeapBuildTest) {
+    buildHeapTest<PriorityQueueBinary<int, int>>();
+}
+
+BOOST_AUTO_TEST_CASE(DaryHeapBuildTest) {
+    buildHeapTest<PriorityQueueDary<int, int>>();
+    buildHeapTest<PriorityQueueDary<int, int, std::less<int>, 8>>();
+}
+
 // Одни и те же указатели на разных кучах и разных их экземплярах работать не должны
 BOOST_AUTO_TEST_CASE(PointersFromDifferentQueuesMustFailTest) {
     PriorityQueueBinary<int, int> binary;
     PriorityQueueBinomial<int, int> binomial;
+    PriorityQueueDary<int, int> dary;
     PQNodePtr<int, int> binaryPtr = binary.insert(5, 5);
     PQNodePtr<int, int> binomialPtr = binomial.insert(3, 3);
+    PQNodePtr<int, int> daryPtr = dary.insert(4, 4);
     BOOST_CHECK_THROW(binary.updatePriority(binomialPtr, 1), std::runtime_error);
     BOOST_CHECK_THROW(binomial.updatePriority(binaryPtr, 1), std::runtime_error);
+    BOOST_CHECK_THROW(dary.updatePriority(binaryPtr, 1), std::runtime_error);
+    BOOST_CHECK_THROW(binary.updatePriority(daryPtr, 1), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(PairingPointersFromDifferentInstancesMustFailTest) {
+    PriorityQueuePairing<int, int> pairing1;
+    PriorityQueuePairing<int, int> pairing2;
+    PriorityQueueBinary<int, int> binary;
+    PQNodePtr<int, int> pairingPtr1 = pairing1.insert(1, 2);
+    PQNodePtr<int, int> pairingPtr2 = pairing2.insert(2, 3);
+    PQNodePtr<int, int> binaryPtr = binary.insert(3, 4);
+    BOOST_CHECK_THROW(pairing2.updatePriority(pairingPtr1, 1), std::runtime_error);
+    BOOST_CHECK_THROW(pairing1.updatePriority(pairingPtr2, 1), std::runtime_error);
+    BOOST_CHECK_THROW(pairing1.updatePriority(binaryPtr, 5), std::runtime_error);
+    // Узел извлеченного элемента переиспользуется, старый указатель остается недействительным
+    pairing1.extractTop();
+    PQNodePtr<int, int> reused = pairing1.insert(5, 6);
+    BOOST_CHECK(!pairingPtr1->isValid());
+    BOOST_CHECK(reused->isValid());
+    BOOST_CHECK_THROW(pairing1.updatePriority(pairingPtr1, 7), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(DaryPointersFromDifferentInstancesMustFailTest) {
+    PriorityQueueDary<int, int> dary1;
+    PriorityQueueDary<int, int> dary2;
+    PQNodePtr<int, int> daryPtr1 = dary1.insert(1, 2);
+    PQNodePtr<int, int> daryPtr2 = dary2.insert(2, 3);
+    BOOST_CHECK_THROW(dary2.updatePriority(daryPtr1, 1), std::runtime_error);
+    BOOST_CHECK_THROW(dary1.updatePriority(daryPtr2, 1), std::runtime_error);
+    // Копия кучи не принимает указатели оригинала
+    PriorityQueueDary<int, int> copy(dary1);
+    BOOST_CHECK_THROW(copy.updatePriority(daryPtr1, 3), std::runtime_error);
+    dary1.clear();
+    BOOST_CHECK(!daryPtr1->isValid());
 }
 
 BOOST_AUTO_TEST_CASE(BinomialPointersFromDifferentInstancesMustFailTest) {
@@ -138,6 +217,15 @@ BOOST_AUTO_TEST_CASE(BinomialHeapDecreasePriorityTest) {
     decreasePriorityTest<PriorityQueueBinomial<int, int, std::greater<int>>>();
 }
 
+BOOST_AUTO_TEST_CASE(PairingHeapDecreasePriorityTest) {
+    decreasePriorityTest<PriorityQueuePairing<int, int, std::greater<int>>>();
+}
+
+BOOST_AUTO_TEST_CASE(DaryHeapDecreasePriorityTest) {
+    decreasePriorityTest<PriorityQueueDary<int, int, std::greater<int>>>();
+    decreasePriorityTest<PriorityQueueDary<int, int, std::greater<int>, 2>>();
+}
+
 template <class Heap> 
 void sizeTest() {
     Heap heap;
@@ -162,6 +250,57 @@ BOOST_AUTO_TEST_CASE(BinomialHeapSizeTest) {
     sizeTest<PriorityQueueBinomial<int, int>>();
 }
 
+BOOST_AUTO_TEST_CASE(DaryHeapSizeTest) {
+    sizeTest<PriorityQueueDary<int, int>>();
+}
+
+BOOST_AUTO_TEST_CASE(PairingHeapSizeTest) {
+    sizeTest<PriorityQueuePairing<int, int>>();
+}
+
+// Много случайных обновлений приоритета, как в алгоритме Дейкстры
+template <class Heap>
+void randomUpdatesTest() {
+    const int ItemsCount = 20000;
+    std::mt19937 random(17);
+    Heap heap;
+    std::vector<PQNodePtr<int, int>> pointers;
+    std::vector<int> priorities;
+    for (int i = 0; i < ItemsCount; ++i) {
+        priorities.push_back(static_cast<int>(random() % 1000000));
+        pointers.push_back(heap.insert(i, priorities.back()));
+    }
+    for (int round = 0; round < 5; ++round) {
+        for (int j = 0; j < ItemsCount; ++j) {
+            int i = static_cast<int>(random() % ItemsCount);
+            if (pointers[i]->isValid()) {
+                priorities[i] += static_cast<int>(random() % 1000);
+                heap.updatePriority(pointers[i], priorities[i]);
+            }
+        }
+        for (int j = 0; j < ItemsCount / 10; ++j) {
+            int key = heap.getTop().getKey();
+            BOOST_CHECK_EQUAL(heap.getTop().getPriority(), priorities[key]);
+            heap.extractTop();
+            BOOST_CHECK(!pointers[key]->isValid());
+        }
+    }
+    int prevPriority = std::numeric_limits<int>::max();
+    while (!heap.empty()) {
+        int key = heap.getTop().getKey();
+        BOOST_CHECK_EQUAL(heap.getTop().getPriority(), priorities[key]);
+        BOOST_CHECK(priorities[key] <= prevPriority);
+        prevPriority = priorities[key];
+        heap.extractTop();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RandomUpdatesTest) {
+    randomUpdatesTest<PriorityQueueBinary<int, int>>();
+    randomUpdatesTest<PriorityQueueDary<int, int>>();
+    randomUpdatesTest<PriorityQueuePairing<int, int>>();
+}
+
 // Тест на конструктор копирования биномиальной кучи
 BOOST_AUTO_TEST_CASE(BinomialHeapCopyTest) {
     PriorityQueueBinomial<int, int> q;
@@ -188,3 +327,205 @@ BOOST_AUTO_TEST_CASE(BinomialHeapCopyTest) {
     BOOST_CHECK(q.empty());
 }
 
+// Копирование и слияние паросочетающихся куч
+BOOST_AUTO_TEST_CASE(PairingHeapCopyAndMeldTest) {
+    PriorityQueuePairing<int, int> q;
+    for (int i = 0; i < 10; ++i) {
+        q.insert(i * 5, i + 1);
+    }
+    PriorityQueuePairing<int, int> q2(q);
+    PriorityQueuePairing<int, int> q3;
+    q3 = q;
+    for (int i = 10; i > 0; --i) {
+        BOOST_CHECK_EQUAL(q2.getTop().getPriority(), i);
+        BOOST_CHECK_EQUAL(q3.getTop().getPriority(), i);
+        q2.extractTop();
+        q3.extractTop();
+    }
+    BOOST_CHECK(q2.empty() && q3.empty());
+    BOOST_CHECK_EQUAL(q.size(), 10);
+
+    PriorityQueuePairing<int, int> other;
+    PQNodePtr<int, int> otherPtr = other.insert(100, 0);
+    for (int i = 0; i < 100; ++i) {
+        other.insert(i, 2 * i + 1);
+    }
+    PQNodePtr<int, int> ptr = q.insert(200, 0);
+    q.meld(other);
+    BOOST_CHECK(other.empty());
+    BOOST_CHECK_EQUAL(q.size(), 112);
+    BOOST_CHECK(!otherPtr->isValid());
+    BOOST_CHECK(ptr->isValid());
+    q.updatePriority(ptr, 1000);
+    BOOST_CHECK_EQUAL(q.getTop().getKey(), 200);
+    // Куча продолжает работать с узлами обоих пулов
+    other.insert(1, 1);
+    BOOST_CHECK_EQUAL(other.size(), 1);
+    for (int i = 0; i < 50; ++i) {
+        q.insert(1000 + i, i);
+    }
+    int prevPriority = std::numeric_limits<int>::max();
+    size_t count = 0;
+    while (!q.empty()) {
+        BOOST_CHECK(q.getTop().getPriority() <= prevPriority);
+        prevPriority = q.getTop().getPriority();
+        q.extractTop();
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, 162);
+    BOOST_CHECK_THROW(q.extractTop(), std::runtime_error);
+}
+
+// Дескрипторы: проверка поколений, переиспользование слотов, обновление приоритета
+template <class Heap>
+void handlesTest() {
+    Heap heap;
+    std::vector<PriorityQueueHandle> handles;
+    for (int i = 0; i < 100; ++i) {
+        handles.push_back(heap.insertHandle(i, i));
+    }
+    BOOST_CHECK_EQUAL(heap.size(), 100);
+    BOOST_CHECK_EQUAL(heap.getNode(handles[42]).getKey(), 42);
+    heap.updatePriority(handles[42], 1000);
+    BOOST_CHECK_EQUAL(heap.getTop().getKey(), 42);
+    BOOST_CHECK_THROW(heap.updatePriority(handles[42], 0), std::invalid_argument);
+    heap.extractTop();
+    BOOST_CHECK(!heap.isValid(handles[42]));
+    BOOST_CHECK_THROW(heap.getNode(handles[42]), std::runtime_error);
+    BOOST_CHECK_THROW(heap.updatePriority(handles[42], 2000), std::runtime_error);
+    BOOST_CHECK(!heap.isValid(PriorityQueueHandle()));
+    // Освобожденный слот занимается снова, старый дескриптор остается недействительным
+    PriorityQueueHandle reused = heap.insertHandle(500, 500);
+    BOOST_CHECK(heap.isValid(reused));
+    BOOST_CHECK(!heap.isValid(handles[42]));
+    BOOST_CHECK_EQUAL(heap.getTop().getKey(), 500);
+    for (int i = 0; i < 100; ++i) {
+        if (i != 42) {
+            BOOST_CHECK(heap.isValid(handles[i]));
+            BOOST_CHECK_EQUAL(heap.getNode(handles[i]).getKey(), i);
+        }
+    }
+    // Копия понимает дескрипторы оригинала
+    Heap copy(heap);
+    copy.updatePriority(handles[7], 2000);
+    BOOST_CHECK_EQUAL(copy.getTop().getKey(), 7);
+    BOOST_CHECK_EQUAL(heap.getTop().getKey(), 500);
+    // Указатель - обертка над дескриптором
+    PQNodePtr<int, int> ptr = heap.insert(600, 600);
+    BOOST_CHECK(heap.isValid(PriorityQueueHandle::unpack(ptr->getId())));
+    heap.clear();
+    BOOST_CHECK(!ptr->isValid());
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK(!heap.isValid(handles[i]));
+    }
+    BOOST_CHECK(!heap.isValid(reused));
+    PriorityQueueHandle fresh = heap.insertHandle(1, 1);
+    BOOST_CHECK(heap.isValid(fresh));
+    BOOST_CHECK(!heap.isValid(handles[0]));
+    BOOST_CHECK_EQUAL(heap.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(BinaryHeapHandlesTest) {
+    handlesTest<PriorityQueueBinary<int, int>>();
+}
+
+BOOST_AUTO_TEST_CASE(BinomialHeapHandlesTest) {
+    handlesTest<PriorityQueueBinomial<int, int>>();
+}
+
+BOOST_AUTO_TEST_CASE(DaryHeapHandlesTest) {
+    handlesTest<PriorityQueueDary<int, int>>();
+    handlesTest<PriorityQueueDary<int, int, std::less<int>, 2>>();
+}
+
+BOOST_AUTO_TEST_CASE(PairingHeapHandlesTest) {
+    handlesTest<PriorityQueuePairing<int, int>>();
+}
+
+// Случайные обновления через дескрипторы
+template <class Heap>
+void randomHandleUpdatesTest() {
+    const int ItemsCount = 20000;
+    std::mt19937 random(23);
+    Heap heap;
+    std::vector<PriorityQueueHandle> handles;
+    std::vector<int> priorities;
+    for (int i = 0; i < ItemsCount; ++i) {
+        priorities.push_back(static_cast<int>(random() % 1000000));
+        handles.push_back(heap.insertHandle(i, priorities.back()));
+    }
+    for (int round = 0; round < 5; ++round) {
+        for (int j = 0; j < ItemsCount; ++j) {
+            int i = static_cast<int>(random() % ItemsCount);
+            if (heap.isValid(handles[i])) {
+                priorities[i] += static_cast<int>(random() % 1000);
+                heap.updatePriority(handles[i], priorities[i]);
+            }
+        }
+        for (int j = 0; j < ItemsCount / 10; ++j) {
+            int key = heap.getTop().getKey();
+            BOOST_CHECK_EQUAL(heap.getTop().getPriority(), priorities[key]);
+            heap.extractTop();
+            BOOST_CHECK(!heap.isValid(handles[key]));
+            // Слот переиспользуется новым элементом
+            priorities[key] = static_cast<int>(random() % 1000000);
+            PriorityQueueHandle handle = heap.insertHandle(key, priorities[key]);
+            BOOST_CHECK(!heap.isValid(handles[key]));
+            handles[key] = handle;
+        }
+    }
+    int prevPriority = std::numeric_limits<int>::max();
+    while (!heap.empty()) {
+        int key = heap.getTop().getKey();
+        BOOST_CHECK_EQUAL(heap.getTop().getPriority(), priorities[key]);
+        BOOST_CHECK(priorities[key] <= prevPriority);
+        prevPriority = priorities[key];
+        heap.extractTop();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RandomHandleUpdatesTest) {
+    randomHandleUpdatesTest<PriorityQueueBinary<int, int>>();
+    randomHandleUpdatesTest<PriorityQueueBinomial<int, int>>();
+    randomHandleUpdatesTest<PriorityQueueDary<int, int>>();
+    randomHandleUpdatesTest<PriorityQueuePairing<int, int>>();
+}
+
+// Дескрипторы переживают слияние паросочетающихся куч
+BOOST_AUTO_TEST_CASE(PairingHeapMeldHandlesTest) {
+    PriorityQueuePairing<int, int> q;
+    PriorityQueuePairing<int, int> other;
+    std::vector<PriorityQueueHandle> handles;
+    for (int i = 0; i < 3000; ++i) {
+        handles.push_back(q.insertHandle(i, i));
+        other.insertHandle(10000 + i, i);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        other.extractTop();
+    }
+    q.meld(other);
+    BOOST_CHECK(other.empty());
+    BOOST_CHECK_EQUAL(q.size(), 5000);
+    for (int i = 0; i < 3000; ++i) {
+        BOOST_CHECK(q.isValid(handles[i]));
+        BOOST_CHECK_EQUAL(q.getNode(handles[i]).getKey(), i);
+    }
+    q.updatePriority(handles[5], 100000);
+    BOOST_CHECK_EQUAL(q.getTop().getKey(), 5);
+    // Новые узлы занимают свободные места обоих пулов
+    for (int i = 0; i < 2000; ++i) {
+        handles.push_back(q.insertHandle(20000 + i, 5000 + i));
+    }
+    int prevPriority = std::numeric_limits<int>::max();
+    size_t count = 0;
+    while (!q.empty()) {
+        BOOST_CHECK(q.getTop().getPriority() <= prevPriority);
+        prevPriority = q.getTop().getPriority();
+        q.extractTop();
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, 7000);
+    for (size_t i = 0; i < handles.size(); ++i) {
+        BOOST_CHECK(!q.isValid(handles[i]));
+    }
+}
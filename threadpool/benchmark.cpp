@@ -0,0 +1,355 @@
+// Performance of ThreadPool against std::async and raw threads:
+//   submit throughput of empty tasks from 1..N producers and in batches,
+//   submit-to-start latency of single tasks on an idle pool,
+//   recursive fork-join (fib, quicksort),
+//   short tasks mixed with blocking ones.
+// Usage: benchmark [threads]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <random>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+
+#include "pool.hpp"
+#include "parallel.hpp"
+#include "metrics.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+long long nanosecondsSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+long long now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+void printRow(const std::string &name, const std::string &value) {
+    std::cout << "  " << std::left << std::setw(56) << name << value << "\n";
+}
+
+std::string formatRate(size_t operations, long long nanoseconds) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << operations * 1000.0 / nanoseconds << " M/s";
+    return out.str();
+}
+
+std::string formatTime(long long nanoseconds) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << nanoseconds / 1e6 << " ms";
+    return out.str();
+}
+
+std::string formatPercentiles(const HistogramSnapshot &histogram) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1)
+        << "p50 " << histogram.getPercentile(50) / 1000.0
+        << " us, p99 " << histogram.getPercentile(99) / 1000.0
+        << " us, max " << histogram.getMax() / 1000.0 << " us";
+    return out.str();
+}
+
+// Waits until count tasks have run
+class Countdown {
+public:
+    explicit Countdown(size_t count): left_(count) { }
+
+    void done() {
+        if (left_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            condition_.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return left_.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    std::atomic<size_t> left_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+};
+
+// Every producer submits tasksPerProducer empty tasks with submitFn
+template <class SubmitFn>
+long long measureSubmit(size_t producers, size_t tasksPerProducer, SubmitFn submitFn) {
+    Countdown countdown(producers * tasksPerProducer);
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&] {
+            for (size_t i = 0; i < tasksPerProducer; ++i) {
+                submitFn(countdown);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    countdown.wait();
+    return nanosecondsSince(start);
+}
+
+void benchmarkSubmit(size_t threads) {
+    std::cout << "Submit throughput, empty tasks\n";
+    const size_t tasks = 200000;
+    std::vector<size_t> producerCounts;
+    for (size_t producers = 1; producers < threads; producers *= 2) {
+        producerCounts.push_back(producers);
+    }
+    producerCounts.push_back(threads);
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        ThreadPoolOptions options;
+        options.setWorkStealing(stealing != 0);
+        ThreadPool pool(threads, options);
+        std::string mode = stealing ? " (work stealing)" : "";
+        for (size_t producers : producerCounts) {
+            long long time = measureSubmit(producers, tasks / producers, [&pool] (Countdown &countdown) {
+                pool.post([&countdown] { countdown.done(); });
+            });
+            printRow("post, producers: " + std::to_string(producers) + mode,
+                     formatRate(tasks / producers * producers, time));
+        }
+        long long time = measureSubmit(1, tasks / 4, [&pool] (Countdown &countdown) {
+            pool.addTask([&countdown] { countdown.done(); });
+        });
+        printRow("addTask (future), producers: 1" + mode, formatRate(tasks / 4, time));
+        // Batches of 1000 tasks from one producer
+        const size_t batchSize = 1000;
+        Countdown countdown(tasks);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < tasks / batchSize; ++i) {
+            std::vector<std::function<void()>> batch(batchSize, [&countdown] { countdown.done(); });
+            pool.addBatch(batch.begin(), batch.end());
+        }
+        countdown.wait();
+        printRow("addBatch (1000 tasks), producers: 1" + mode, formatRate(tasks, nanosecondsSince(start)));
+    }
+    // Baselines create a thread per task, so fewer tasks
+    const size_t threadTasks = 5000;
+    std::vector<std::future<void>> futures;
+    futures.reserve(threadTasks);
+    long long time = measureSubmit(1, threadTasks, [&futures] (Countdown &countdown) {
+        futures.push_back(std::async(std::launch::async, [&countdown] { countdown.done(); }));
+    });
+    printRow("std::async, producers: 1", formatRate(threadTasks, time));
+    futures.clear();
+    time = measureSubmit(1, threadTasks, [] (Countdown &countdown) {
+        std::thread([&countdown] { countdown.done(); }).detach();
+    });
+    printRow("std::thread per task, producers: 1", formatRate(threadTasks, time));
+}
+
+// Submit-to-start time of a task given to an idle executor
+template <class SubmitFn>
+HistogramSnapshot measureLatency(size_t samples, SubmitFn submitFn) {
+    LatencyHistogram histogram;
+    for (size_t i = 0; i < samples; ++i) {
+        std::promise<long long> started;
+        std::future<long long> startTime = started.get_future();
+        long long submitted = now();
+        submitFn([&started] { started.set_value(now()); });
+        histogram.record(startTime.get() - submitted);
+        // Lets the workers go idle again
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return HistogramSnapshot(histogram);
+}
+
+void benchmarkLatency(size_t threads) {
+    std::cout << "Submit-to-start latency, idle executor\n";
+    const size_t samples = 2000;
+    {
+        ThreadPool pool(threads);
+        printRow("ThreadPool, parking workers", formatPercentiles(measureLatency(samples,
+            [&pool] (std::function<void()> fn) { pool.post(std::move(fn)); })));
+    }
+    {
+        ThreadPoolOptions options;
+        options.setSpinCount(1 << 14);
+        options.setYieldCount(64);
+        ThreadPool pool(threads, options);
+        printRow("ThreadPool, spinning workers", formatPercentiles(measureLatency(samples,
+            [&pool] (std::function<void()> fn) { pool.post(std::move(fn)); })));
+    }
+    {
+        ThreadPool pool(threads);
+        printRow("ThreadPool, priority task", formatPercentiles(measureLatency(samples,
+            [&pool] (std::function<void()> fn) { pool.addTask(TaskPriority::High, std::move(fn)); })));
+    }
+    printRow("std::async", formatPercentiles(measureLatency(samples / 4, [] (std::function<void()> fn) {
+        std::async(std::launch::async, std::move(fn));
+    })));
+    printRow("std::thread", formatPercentiles(measureLatency(samples / 4, [] (std::function<void()> fn) {
+        std::thread(std::move(fn)).join();
+    })));
+}
+
+long long fibSequential(int n) {
+    return n < 2 ? n : fibSequential(n - 1) + fibSequential(n - 2);
+}
+
+// Forks down to cutoff, waits by running other tasks
+long long fibPool(ThreadPool &pool, int n, int cutoff) {
+    if (n <= cutoff) {
+        return fibSequential(n);
+    }
+    std::future<long long> left = pool.addTask([&pool, n, cutoff] { return fibPool(pool, n - 1, cutoff); });
+    long long right = fibPool(pool, n - 2, cutoff);
+    pool.wait(left);
+    return left.get() + right;
+}
+
+// Same shape with a thread per fork, depth limited to stay alive
+long long fibAsync(int n, int cutoff) {
+    if (n <= cutoff) {
+        return fibSequential(n);
+    }
+    std::future<long long> left = std::async(std::launch::async, [n, cutoff] { return fibAsync(n - 1, cutoff); });
+    long long right = fibAsync(n - 2, cutoff);
+    return left.get() + right;
+}
+
+template <class RandomIt>
+void quickSortAsync(RandomIt first, RandomIt last, int depth) {
+    if (depth == 0 || last - first < 2048) {
+        std::sort(first, last);
+        return;
+    }
+    typedef typename std::iterator_traits<RandomIt>::value_type T;
+    T pivot = *(first + (last - first) / 2);
+    RandomIt middle1 = std::partition(first, last, [&pivot] (const T &item) { return item < pivot; });
+    RandomIt middle2 = std::partition(middle1, last, [&pivot] (const T &item) { return !(pivot < item); });
+    std::future<void> upper = std::async(std::launch::async, [middle2, last, depth] {
+        quickSortAsync(middle2, last, depth - 1);
+    });
+    quickSortAsync(first, middle1, depth - 1);
+    upper.get();
+}
+
+void benchmarkForkJoin(size_t threads) {
+    std::cout << "Fork-join\n";
+    const int n = 32;
+    Clock::time_point start = Clock::now();
+    long long expected = fibSequential(n);
+    printRow("fib(" + std::to_string(n) + "), sequential", formatTime(nanosecondsSince(start)));
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        ThreadPoolOptions options;
+        options.setWorkStealing(stealing != 0);
+        ThreadPool pool(threads, options);
+        start = Clock::now();
+        long long result = fibPool(pool, n, 16);
+        printRow(std::string("fib, ThreadPool") + (stealing ? " (work stealing)" : ""),
+                 formatTime(nanosecondsSince(start)) + (result == expected ? "" : " WRONG"));
+    }
+    start = Clock::now();
+    long long result = fibAsync(n, 22);
+    printRow("fib, std::async (cutoff 22)", formatTime(nanosecondsSince(start)) + (result == expected ? "" : " WRONG"));
+
+    const size_t size = 4000000;
+    std::vector<int> source(size);
+    std::mt19937 random(42);
+    for (auto &item : source) {
+        item = static_cast<int>(random());
+    }
+    std::vector<int> data = source;
+    start = Clock::now();
+    std::sort(data.begin(), data.end());
+    printRow("quicksort " + std::to_string(size) + ", std::sort", formatTime(nanosecondsSince(start)));
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        ThreadPoolOptions options;
+        options.setWorkStealing(stealing != 0);
+        ThreadPool pool(threads, options);
+        data = source;
+        start = Clock::now();
+        parallelSort(pool, data.begin(), data.end());
+        printRow(std::string("quicksort, parallelSort") + (stealing ? " (work stealing)" : ""),
+                 formatTime(nanosecondsSince(start)) + (std::is_sorted(data.begin(), data.end()) ? "" : " WRONG"));
+    }
+    data = source;
+    start = Clock::now();
+    quickSortAsync(data.begin(), data.end(), 8);
+    printRow("quicksort, std::async (depth 8)",
+             formatTime(nanosecondsSince(start)) + (std::is_sorted(data.begin(), data.end()) ? "" : " WRONG"));
+}
+
+// Short tasks behind blocking ones: time until all short tasks finished
+void benchmarkMixed(size_t threads) {
+    std::cout << "Short tasks mixed with blocking ones (1 ms sleep each)\n";
+    const size_t blockingTasks = threads * 4;
+    const size_t shortTasks = 20000;
+    for (int elastic = 0; elastic < 2; ++elastic) {
+        ThreadPoolOptions options;
+        if (elastic) {
+            options.setMaxThreadCount(threads * 4);
+            options.setQueueLatencyThreshold(std::chrono::milliseconds(1));
+        }
+        ThreadPool pool(threads, options);
+        Countdown blocked(blockingTasks);
+        Countdown shortDone(shortTasks);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < std::max(blockingTasks, shortTasks); ++i) {
+            if (i < blockingTasks) {
+                pool.post([&pool, &blocked] {
+                    BlockingScope scope(pool);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    blocked.done();
+                });
+            }
+            if (i < shortTasks) {
+                pool.post([&shortDone] { shortDone.done(); });
+            }
+        }
+        shortDone.wait();
+        long long shortTime = nanosecondsSince(start);
+        blocked.wait();
+        long long allTime = nanosecondsSince(start);
+        printRow(std::string("ThreadPool") + (elastic ? " (elastic)" : "") + ", short tasks done",
+                 formatTime(shortTime) + ", all done " + formatTime(allTime));
+    }
+    Countdown blocked(blockingTasks);
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> sleepers;
+    for (size_t i = 0; i < blockingTasks; ++i) {
+        sleepers.emplace_back([&blocked] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            blocked.done();
+        });
+    }
+    ThreadPool pool(threads);
+    Countdown shortDone(shortTasks);
+    for (size_t i = 0; i < shortTasks; ++i) {
+        pool.post([&shortDone] { shortDone.done(); });
+    }
+    shortDone.wait();
+    long long shortTime = nanosecondsSince(start);
+    blocked.wait();
+    printRow("raw threads for blocking, pool for short", formatTime(shortTime) + ", all done " +
+             formatTime(nanosecondsSince(start)));
+    for (auto &thread : sleepers) {
+        thread.join();
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc > 1) {
+        threads = std::max(1, std::atoi(argv[1]));
+    }
+    std::cout << "Threads: " << threads << "\n";
+    benchmarkSubmit(threads);
+    benchmarkLatency(threads);
+    benchmarkForkJoin(threads);
+    benchmarkMixed(threads);
+    return 0;
+}
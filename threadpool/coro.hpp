@@ -0,0 +1,302 @@
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "coro.hpp needs C++20 coroutines (-std=c++20)"
+#endif
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+#include <type_traits>
+#include <condition_variable>
+
+#include "pool.hpp"
+
+// Coroutines on top of ThreadPool. A coroutine hops onto a worker with
+// co_await pool.schedule() and suspends instead of blocking a thread, so
+// many operations in flight share a few workers:
+//
+//     CoroTask<int> handle(ThreadPool &pool) {
+//         co_await pool.schedule();
+//         co_await pool.scheduleAfter(std::chrono::milliseconds(10));
+//         co_return 42;
+//     }
+//
+//     int value = syncWait(handle(pool));
+
+template <class T> class CoroTask;
+
+// Resumes the coroutine that awaits the finished one, if any
+struct CoroFinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        std::coroutine_handle<> continuation = handle.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept { }
+};
+
+class CoroPromiseBase {
+public:
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    CoroFinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+template <class T>
+class CoroPromise: public CoroPromiseBase {
+public:
+    CoroTask<T> get_return_object();
+
+    template <class U>
+    void return_value(U &&value) { result.emplace(std::forward<U>(value)); }
+
+    T takeResult() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*result);
+    }
+
+    std::optional<T> result;
+};
+
+template <>
+class CoroPromise<void>: public CoroPromiseBase {
+public:
+    CoroTask<void> get_return_object();
+
+    void return_void() { }
+
+    void takeResult() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// Lazy coroutine: starts when awaited and resumes the awaiting coroutine
+// on the thread that finishes it, never blocking one. Move-only, awaited
+// once. Exceptions are rethrown to the awaiting coroutine
+template <class T>
+class CoroTask {
+public:
+    typedef CoroPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    CoroTask(): handle_(nullptr) { }
+
+    explicit CoroTask(Handle handle):
+        handle_(handle)
+    { }
+
+    CoroTask(CoroTask &&rhs) noexcept:
+        handle_(std::exchange(rhs.handle_, nullptr))
+    { }
+
+    CoroTask &operator= (CoroTask &&rhs) noexcept {
+        if (&rhs != this) {
+            destroy();
+            handle_ = std::exchange(rhs.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    CoroTask(const CoroTask &rhs) = delete;
+    CoroTask &operator= (const CoroTask &rhs) = delete;
+
+    ~CoroTask() { destroy(); }
+
+    bool isValid() const { return static_cast<bool>(handle_); }
+    bool isReady() const { return !handle_ || handle_.done(); }
+
+    // Value or error of a finished task, for code outside of coroutines
+    T takeResult() { return handle_.promise().takeResult(); }
+
+    class ReadyAwaiter {
+    public:
+        explicit ReadyAwaiter(Handle handle): handle_(handle) { }
+
+        bool await_ready() const { return !handle_ || handle_.done(); }
+
+        // Symmetric transfer: starts the task without growing the stack
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+
+        void await_resume() const { }
+
+    protected:
+        Handle handle_;
+    };
+
+    class Awaiter: public ReadyAwaiter {
+    public:
+        explicit Awaiter(Handle handle): ReadyAwaiter(handle) { }
+
+        T await_resume() { return this->handle_.promise().takeResult(); }
+    };
+
+    Awaiter operator co_await() const { return Awaiter(handle_); }
+
+    // Finishes with the task, leaving its value or error for takeResult
+    ReadyAwaiter whenReady() const { return ReadyAwaiter(handle_); }
+
+private:
+    void destroy() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    Handle handle_;
+};
+
+template <class T>
+CoroTask<T> CoroPromise<T>::get_return_object() {
+    return CoroTask<T>(std::coroutine_handle<CoroPromise<T>>::from_promise(*this));
+}
+
+inline CoroTask<void> CoroPromise<void>::get_return_object() {
+    return CoroTask<void>(std::coroutine_handle<CoroPromise<void>>::from_promise(*this));
+}
+
+// Eager coroutine nobody awaits, its frame is freed when it finishes
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() const { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const { }
+        void unhandled_exception() const { std::terminate(); }
+    };
+};
+
+// Resumes the awaiting coroutine after every task of a set has finished
+class WhenAllCounter {
+public:
+    explicit WhenAllCounter(size_t count):
+        count_(count)
+    { }
+
+    void setAwaiting(std::coroutine_handle<> awaiting) { awaiting_ = awaiting; }
+
+    // True for the last arrival
+    bool arrive() {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    void arriveAndResume() {
+        if (arrive()) {
+            awaiting_.resume();
+        }
+    }
+
+private:
+    std::atomic<size_t> count_;
+    std::coroutine_handle<> awaiting_;
+};
+
+// Results stay in the task, they are taken after all tasks finished
+template <class T>
+DetachedCoroutine runWhenAllTask(CoroTask<T> &task, WhenAllCounter &counter) {
+    co_await task.whenReady();
+    counter.arriveAndResume();
+}
+
+template <class T>
+class WhenAllAwaiter {
+public:
+    explicit WhenAllAwaiter(std::vector<CoroTask<T>> &tasks):
+        tasks_(tasks),
+        // The awaiting coroutine counts too, so nobody resumes it before it suspended
+        counter_(tasks.size() + 1)
+    { }
+
+    bool await_ready() const { return tasks_.empty(); }
+
+    bool await_suspend(std::coroutine_handle<> awaiting) {
+        counter_.setAwaiting(awaiting);
+        for (auto &task : tasks_) {
+            runWhenAllTask(task, counter_);
+        }
+        return !counter_.arrive();
+    }
+
+    void await_resume() const { }
+
+private:
+    std::vector<CoroTask<T>> &tasks_;
+    WhenAllCounter counter_;
+};
+
+// Starts all tasks at once and finishes when every one of them has. Tasks
+// run concurrently from their first suspension on, typically schedule().
+// Values are in the order of tasks, the first error (in that order) is
+// rethrown
+template <class T>
+CoroTask<std::vector<T>> whenAll(std::vector<CoroTask<T>> tasks) {
+    co_await WhenAllAwaiter<T>(tasks);
+    std::vector<T> results;
+    results.reserve(tasks.size());
+    for (auto &task : tasks) {
+        results.push_back(task.takeResult());
+    }
+    co_return results;
+}
+
+inline CoroTask<void> whenAll(std::vector<CoroTask<void>> tasks) {
+    co_await WhenAllAwaiter<void>(tasks);
+    for (auto &task : tasks) {
+        task.takeResult();
+    }
+}
+
+class SyncWaitLatch {
+public:
+    SyncWaitLatch(): done_(false) { }
+
+    void set() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        condition_.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return done_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool done_;
+};
+
+template <class T>
+DetachedCoroutine runSyncWaitTask(CoroTask<T> &task, SyncWaitLatch &latch) {
+    co_await task.whenReady();
+    latch.set();
+}
+
+// Blocks the calling thread until task finishes and returns its value or
+// rethrows its error. Bridge from ordinary code, calling it from a worker
+// takes the worker away from the pool for the whole wait
+template <class T>
+T syncWait(CoroTask<T> task) {
+    SyncWaitLatch latch;
+    runSyncWaitTask(task, latch);
+    latch.wait();
+    return task.takeResult();
+}
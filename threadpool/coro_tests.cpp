@@ -0,0 +1,76 @@
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+
+#include "coro.hpp"
+#define BOOST_TEST_MODULE CoroutineTest
+#include <boost/test/included/unit_test.hpp>
+
+ThreadPool pool(3);
+
+CoroTask<int> square(ThreadPool &pool, int value) {
+    co_await pool.schedule();
+    BOOST_CHECK(pool.isWorkerThread());
+    co_return value * value;
+}
+
+CoroTask<int> sumOfSquares(ThreadPool &pool, int count) {
+    int sum = 0;
+    for (int i = 1; i <= count; ++i) {
+        sum += co_await square(pool, i);
+    }
+    co_return sum;
+}
+
+CoroTask<void> fail(ThreadPool &pool) {
+    co_await pool.schedule();
+    throw std::runtime_error("failed");
+}
+
+BOOST_AUTO_TEST_CASE(ScheduleTest) {
+    BOOST_CHECK_EQUAL(syncWait(square(pool, 7)), 49);
+    BOOST_CHECK_EQUAL(syncWait(sumOfSquares(pool, 10)), 385);
+    BOOST_CHECK_THROW(syncWait(fail(pool)), std::runtime_error);
+
+    auto delayed = [] (ThreadPool &pool) -> CoroTask<std::chrono::steady_clock::duration> {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        co_await pool.scheduleAfter(std::chrono::milliseconds(10));
+        co_return std::chrono::steady_clock::now() - start;
+    };
+    BOOST_CHECK(syncWait(delayed(pool)) >= std::chrono::milliseconds(10));
+}
+
+// Many suspended operations share few workers
+CoroTask<int> request(ThreadPool &pool, int id, std::atomic<int> &inFlight, std::atomic<int> &maxInFlight) {
+    co_await pool.schedule();
+    int current = ++inFlight;
+    int max = maxInFlight;
+    while (current > max && !maxInFlight.compare_exchange_weak(max, current)) { }
+    co_await pool.scheduleAfter(std::chrono::milliseconds(20));
+    --inFlight;
+    co_return id;
+}
+
+BOOST_AUTO_TEST_CASE(WhenAllTest) {
+    const int count = 2000;
+    std::atomic<int> inFlight(0);
+    std::atomic<int> maxInFlight(0);
+    std::vector<CoroTask<int>> requests;
+    for (int i = 0; i < count; ++i) {
+        requests.push_back(request(pool, i, inFlight, maxInFlight));
+    }
+    std::vector<int> ids = syncWait(whenAll(std::move(requests)));
+    BOOST_REQUIRE_EQUAL(ids.size(), count);
+    for (int i = 0; i < count; ++i) {
+        BOOST_CHECK_EQUAL(ids[i], i);
+    }
+    BOOST_CHECK(maxInFlight > 100);
+    BOOST_CHECK_EQUAL(inFlight, 0);
+
+    std::vector<CoroTask<void>> failing;
+    failing.push_back(fail(pool));
+    failing.push_back(fail(pool));
+    BOOST_CHECK_THROW(syncWait(whenAll(std::move(failing))), std::runtime_error);
+    BOOST_CHECK(syncWait(whenAll(std::vector<CoroTask<int>>())).empty());
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <chrono>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+// Lets threads sleep until some condition of lock-free data becomes true
+// without a mutex on the notifying side. Waiter:
+//
+//     EventCount::Key key = ec.prepareWait();
+//     if (condition()) { ec.cancelWait(); ... } else { ec.commitWait(key); }
+//
+// Notifier makes the condition true and calls notifyOne()/notifyAll(), which
+// cost a single load when nobody is waiting. Notification between
+// prepareWait and commitWait changes the epoch, so commitWait returns
+// immediately instead of missing it. On Linux sleeping is a futex wait on
+// the epoch word, elsewhere a condition variable.
+class EventCount {
+public:
+    typedef uint32_t Key;
+
+    EventCount():
+        epoch_(0),
+        waiters_(0)
+    { }
+
+    EventCount(const EventCount &rhs) = delete;
+    EventCount &operator= (const EventCount &rhs) = delete;
+
+    Key prepareWait() {
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        // Pairs with the fence in notify: either the notifier sees us in
+        // waiters_ or we see its data when checking the condition
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch_.load(std::memory_order_acquire);
+    }
+
+    void cancelWait() {
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commitWait(Key key) {
+#ifdef __linux__
+        while (epoch_.load(std::memory_order_acquire) == key) {
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch_), FUTEX_WAIT_PRIVATE,
+                    key, nullptr, nullptr, 0);
+        }
+#else
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (epoch_.load(std::memory_order_acquire) == key) {
+            condition_.wait(lock);
+        }
+#endif
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Returns false if timeout expired without notification
+    bool commitWaitFor(Key key, std::chrono::microseconds timeout) {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+        bool notified = true;
+#ifdef __linux__
+        while (epoch_.load(std::memory_order_acquire) == key) {
+            std::chrono::steady_clock::duration left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero()) {
+                notified = false;
+                break;
+            }
+            std::chrono::nanoseconds ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+            timespec relative;
+            relative.tv_sec = static_cast<time_t>(ns.count() / 1000000000);
+            relative.tv_nsec = static_cast<long>(ns.count() % 1000000000);
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch_), FUTEX_WAIT_PRIVATE,
+                    key, &relative, nullptr, 0);
+        }
+#else
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            notified = condition_.wait_until(lock, deadline, [this, key] {
+                return epoch_.load(std::memory_order_acquire) != key;
+            });
+        }
+#endif
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return notified;
+    }
+
+    void notifyOne() { notify(1); }
+    void notifyAll() { notify(INT_MAX); }
+
+    // Wakes up to count waiters at once
+    void notifyMany(size_t count) {
+        notify(static_cast<int>(std::min<size_t>(count, INT_MAX)));
+    }
+
+    bool hasWaiters() const {
+        return waiters_.load(std::memory_order_relaxed) != 0;
+    }
+
+private:
+    void notify(int count) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+#ifdef __linux__
+        epoch_.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch_), FUTEX_WAKE_PRIVATE,
+                count, nullptr, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mutex_);
+        epoch_.fetch_add(1, std::memory_order_release);
+        if (count == 1) {
+            condition_.notify_one();
+        } else {
+            condition_.notify_all();
+        }
+#endif
+    }
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+
+    std::atomic<uint32_t> epoch_;
+    std::atomic<uint32_t> waiters_;
+#ifndef __linux__
+    std::mutex mutex_;
+    std::condition_variable condition_;
+#endif
+};
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <future>
+#include <thread>
+#include <stdexcept>
+#include <type_traits>
+#include <condition_variable>
+
+#include "pool.hpp"
+
+// One pool for the whole process: libraries and the application share its
+// workers instead of each starting their own threads. TaskArena caps how
+// many of them one caller occupies.
+
+class DefaultExecutor {
+public:
+    // Size and options of the pool, must be called before the first get().
+    // Default: hardware_concurrency workers with work stealing
+    static void configure(size_t threadCount, const ThreadPoolOptions &options = getDefaultOptions()) {
+        std::lock_guard<std::mutex> lock(getMutex());
+        if (getInstance().pool) {
+            throw std::logic_error("Executor is already running (DefaultExecutor::configure)");
+        }
+        getThreadCountSetting() = threadCount;
+        getOptionsSetting() = options;
+    }
+
+    // Started on first use, stopped at exit
+    static ThreadPool &get() {
+        std::lock_guard<std::mutex> lock(getMutex());
+        Instance &instance = getInstance();
+        if (!instance.pool) {
+            instance.pool = new (&instance.storage) ThreadPool(getThreadCountSetting(), getOptionsSetting());
+        }
+        return *instance.pool;
+    }
+
+    static ThreadPoolOptions getDefaultOptions() {
+        ThreadPoolOptions options;
+        options.setWorkStealing(true);
+        return options;
+    }
+
+private:
+    // Static storage rather than new: ThreadPool is cache line aligned,
+    // which plain new does not honour before C++17
+    struct Instance {
+        Instance(): pool(nullptr) { }
+
+        ~Instance() {
+            if (pool) {
+                pool->~ThreadPool();
+            }
+        }
+
+        typename std::aligned_storage<sizeof(ThreadPool), alignof(ThreadPool)>::type storage;
+        ThreadPool *pool;
+    };
+
+    static std::mutex &getMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static Instance &getInstance() {
+        static Instance instance;
+        return instance;
+    }
+
+    static size_t &getThreadCountSetting() {
+        static size_t threadCount = std::thread::hardware_concurrency();
+        return threadCount;
+    }
+
+    static ThreadPoolOptions &getOptionsSetting() {
+        static ThreadPoolOptions options = getDefaultOptions();
+        return options;
+    }
+};
+
+// View of a pool running at most concurrency of its tasks at once. Tasks
+// above the limit wait in the arena and are posted to the pool as running
+// ones finish. A task of the arena waiting for another one (wait, helpUntil,
+// parallel algorithms) runs queued arena tasks itself, in its own slot, so
+// nested fork-join never deadlocks on the limit. Destructor waits for all
+// tasks of the arena
+class TaskArena {
+public:
+    TaskArena(ThreadPool &pool, size_t concurrency):
+        state_(std::make_shared<State>(pool, concurrency))
+    {
+        if (concurrency == 0) {
+            throw std::invalid_argument("Concurrency must be positive (TaskArena::TaskArena)");
+        }
+    }
+
+    TaskArena(const TaskArena &rhs) = delete;
+    TaskArena &operator= (const TaskArena &rhs) = delete;
+
+    ~TaskArena() { wait(); }
+
+    ThreadPool &getPool() const { return state_->pool; }
+    size_t getConcurrency() const { return state_->concurrency; }
+
+    // Threads the arena may use at once, for splitting work
+    size_t getThreadCount() const {
+        return std::min(state_->concurrency, state_->pool.getThreadCount());
+    }
+
+    template <class Fn>
+    std::future<typename std::result_of<Fn()>::type> addTask(Fn task) {
+        typedef PromiseTask<Fn> Promised;
+        Promised promised = {Promised::makePromise(), std::move(task)};
+        std::future<typename std::result_of<Fn()>::type> result = promised.promise.get_future();
+        post(std::move(promised));
+        return result;
+    }
+
+    // Task must not throw, as with ThreadPool::post
+    template <class Fn>
+    void post(Fn task) {
+        Task queued(std::move(task));
+        {
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            ++state_->pending;
+            state_->queue.push_back(std::move(queued));
+            if (state_->active == state_->concurrency) {
+                return;
+            }
+            ++state_->active;
+        }
+        SlotTask slot = {state_};
+        state_->pool.post(std::move(slot));
+    }
+
+    // Waits for every task posted so far
+    void wait() {
+        State &state = *state_;
+        helpUntil([&state] (std::chrono::microseconds timeout) {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            return state.condition.wait_for(lock, timeout, [&state] { return state.pending == 0; });
+        });
+    }
+
+    template <class T>
+    void wait(const std::future<T> &future) {
+        helpUntil([&future] (std::chrono::microseconds timeout) {
+            return future.wait_for(timeout) == std::future_status::ready;
+        });
+    }
+
+    // ThreadPool::helpUntil, which inside a task of this arena also runs
+    // tasks queued in the arena
+    template <class WaitFn>
+    void helpUntil(WaitFn waitFor) {
+        std::shared_ptr<State> state = state_;
+        state->pool.helpUntil([&state, &waitFor] (std::chrono::microseconds timeout) {
+            if (currentArena() == state.get()) {
+                Task task;
+                while (!waitFor(std::chrono::microseconds(0))) {
+                    if (!state->tryPop(task)) {
+                        return waitFor(timeout);
+                    }
+                    task();
+                    task.reset();
+                    state->finish();
+                }
+                return true;
+            }
+            return waitFor(timeout);
+        });
+    }
+
+private:
+    struct State {
+        State(ThreadPool &threadPool, size_t maxConcurrency):
+            pool(threadPool),
+            concurrency(maxConcurrency),
+            active(0),
+            pending(0)
+        { }
+
+        bool tryPop(Task &task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return pop(task);
+        }
+
+        // Gives the slot back if there is nothing to run, in one step with
+        // the check, so that post() starts a new slot for the next task
+        bool popOrRelease(Task &task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pop(task)) {
+                return true;
+            }
+            --active;
+            return false;
+        }
+
+        bool pop(Task &task) {
+            if (queue.empty()) {
+                return false;
+            }
+            task = std::move(queue.front());
+            queue.pop_front();
+            return true;
+        }
+
+        void finish() {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishLocked();
+        }
+
+        // Task of a slot is done. True if the slot goes on to a queued task,
+        // otherwise it is given back
+        bool finishInSlot() {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishLocked();
+            if (queue.empty()) {
+                --active;
+                return false;
+            }
+            return true;
+        }
+
+        void finishLocked() {
+            if (--pending == 0) {
+                condition.notify_all();
+            }
+        }
+
+        ThreadPool &pool;
+        size_t concurrency;
+        // Slots posted to the pool, at most concurrency
+        size_t active;
+        // Tasks not finished, queued or not
+        size_t pending;
+        std::deque<Task> queue;
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+
+    // One of the arena's slots: runs the oldest queued task. Small enough
+    // to be stored in the pool's task without allocation
+    struct SlotTask {
+        void operator()() {
+            Task task;
+            if (!state->popOrRelease(task)) {
+                // Taken by a waiting task of the arena
+                return;
+            }
+            State *outer = currentArena();
+            currentArena() = state.get();
+            task();
+            currentArena() = outer;
+            task.reset();
+            if (state->finishInSlot()) {
+                // Through the pool, so that other users get their turn
+                SlotTask slot = {state};
+                state->pool.post(std::move(slot));
+            }
+        }
+
+        std::shared_ptr<State> state;
+    };
+
+    // Arena whose task runs on this thread
+    static State *&currentArena() {
+        static thread_local State *arena = nullptr;
+        return arena;
+    }
+
+    std::shared_ptr<State> state_;
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <new>
+#include <mutex>
+#include <future>
+#include <cstddef>
+#include <utility>
+#include <exception>
+#include <type_traits>
+
+// Recycles the small blocks of promise/future shared states. Every thread
+// keeps a free list of up to CacheSize blocks; blocks freed by another thread
+// go to the freeing thread's list, and lists move half of their blocks
+// through a shared depot when they overflow or run dry. Larger requests go
+// to operator new.
+class FutureStatePool {
+public:
+    static const size_t BlockSize = 128;
+    static const size_t CacheSize = 256;
+
+    static void *allocate(size_t size) {
+        if (size > BlockSize) {
+            return ::operator new(size);
+        }
+        Cache &cache = getCache();
+        if (!cache.head && !cache.closed) {
+            getReleaser().touch();
+            refill(cache);
+        }
+        if (!cache.head) {
+            return ::operator new(BlockSize);
+        }
+        Block *block = cache.head;
+        cache.head = block->next;
+        --cache.count;
+        return block;
+    }
+
+    static void deallocate(void *p, size_t size) {
+        if (size > BlockSize) {
+            ::operator delete(p);
+            return;
+        }
+        Cache &cache = getCache();
+        if (cache.closed) {
+            Block *block = static_cast<Block *>(p);
+            block->next = nullptr;
+            release(block, block, 1);
+            return;
+        }
+        // A thread may only free blocks, e.g. a worker running tasks of
+        // others, its cache must go back to the depot on exit as well
+        getReleaser().touch();
+        if (cache.count == CacheSize) {
+            flush(cache, CacheSize / 2);
+        }
+        Block *block = static_cast<Block *>(p);
+        block->next = cache.head;
+        cache.head = block;
+        ++cache.count;
+    }
+
+    // Blocks in the shared depot, for tests and diagnostics
+    static size_t getDepotSize() {
+        Depot &depot = getDepot();
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        return depot.count;
+    }
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    // Trivial, so it stays usable while other thread_locals are destroyed
+    struct Cache {
+        Block *head;
+        size_t count;
+        bool closed;
+    };
+
+    struct Depot {
+        Depot(): head(nullptr), count(0) { }
+
+        std::mutex mutex;
+        Block *head;
+        size_t count;
+    };
+
+    // Returns the blocks of the exiting thread to the depot
+    struct Releaser {
+        void touch() { }
+
+        ~Releaser() {
+            Cache &cache = getCache();
+            flush(cache, cache.count);
+            cache.closed = true;
+        }
+    };
+
+    static Cache &getCache() {
+        static thread_local Cache cache = {nullptr, 0, false};
+        return cache;
+    }
+
+    static Releaser &getReleaser() {
+        static thread_local Releaser releaser;
+        return releaser;
+    }
+
+    // Never destroyed: states may be freed during static destruction
+    static Depot &getDepot() {
+        static Depot *depot = new Depot();
+        return *depot;
+    }
+
+    static void flush(Cache &cache, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        Block *first = cache.head;
+        Block *last = first;
+        for (size_t i = 1; i < count; ++i) {
+            last = last->next;
+        }
+        cache.head = last->next;
+        cache.count -= count;
+        release(first, last, count);
+    }
+
+    static void release(Block *first, Block *last, size_t count) {
+        Depot &depot = getDepot();
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        last->next = depot.head;
+        depot.head = first;
+        depot.count += count;
+    }
+
+    static void refill(Cache &cache) {
+        Depot &depot = getDepot();
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        while (depot.head && cache.count < CacheSize / 2) {
+            Block *block = depot.head;
+            depot.head = block->next;
+            --depot.count;
+            block->next = cache.head;
+            cache.head = block;
+            ++cache.count;
+        }
+    }
+};
+
+template <class T>
+class FutureStateAllocator {
+public:
+    typedef T value_type;
+
+    FutureStateAllocator() { }
+
+    template <class U>
+    FutureStateAllocator(const FutureStateAllocator<U> &) { }
+
+    T *allocate(size_t n) {
+        if (alignof(T) > alignof(std::max_align_t)) {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T *>(FutureStatePool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (alignof(T) > alignof(std::max_align_t)) {
+            ::operator delete(p);
+            return;
+        }
+        FutureStatePool::deallocate(p, n * sizeof(T));
+    }
+
+    // Needed by pre-C++11 allocator_traits of older libstdc++
+    template <class U>
+    struct rebind {
+        typedef FutureStateAllocator<U> other;
+    };
+};
+
+template <class T, class U>
+bool operator== (const FutureStateAllocator<T> &, const FutureStateAllocator<U> &) { return true; }
+
+template <class T, class U>
+bool operator!= (const FutureStateAllocator<T> &, const FutureStateAllocator<U> &) { return false; }
+
+// Replaces packaged_task for the pool: the shared state comes from
+// FutureStatePool and the callable is kept in the task itself, inline
+// when it is small enough (see Task::InlineSize)
+template <class Fn, class Ret = typename std::result_of<Fn()>::type>
+struct PromiseTask {
+    static std::promise<Ret> makePromise() {
+        return std::promise<Ret>(std::allocator_arg, FutureStateAllocator<char>());
+    }
+
+    void operator()() {
+        try {
+            promise.set_value(fn());
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    std::promise<Ret> promise;
+    Fn fn;
+};
+
+template <class Fn>
+struct PromiseTask<Fn, void> {
+    static std::promise<void> makePromise() {
+        return std::promise<void>(std::allocator_arg, FutureStateAllocator<char>());
+    }
+
+    void operator()() {
+        try {
+            fn();
+            promise.set_value();
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    std::promise<void> promise;
+    Fn fn;
+};
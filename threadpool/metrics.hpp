@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+
+// Runtime statistics of ThreadPool (see ThreadPool::getMetrics)
+
+// Log-linear histogram in the spirit of HdrHistogram: every power of two is
+// split into 2^SubBucketBits equal buckets, so any recorded value is known
+// within 1 / 2^SubBucketBits of relative error. Recording is a few relaxed
+// atomic increments, reading may happen concurrently.
+class LatencyHistogram {
+public:
+    static const int SubBucketBits = 3;
+    static const size_t SubBucketCount = size_t(1) << SubBucketBits;
+    // Values up to 2^MaxBits - 1, larger ones go to the last bucket
+    static const int MaxBits = 48;
+    static const size_t BucketCount = (MaxBits - SubBucketBits + 1) * SubBucketCount;
+
+    LatencyHistogram():
+        count_(0),
+        sum_(0),
+        max_(0)
+    {
+        for (auto &bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogram(const LatencyHistogram &rhs) = delete;
+    LatencyHistogram &operator= (const LatencyHistogram &rhs) = delete;
+
+    void record(uint64_t value) {
+        buckets_[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) { }
+    }
+
+    uint64_t getCount() const { return count_.load(std::memory_order_relaxed); }
+
+    static size_t getBucket(uint64_t value) {
+        if (value < SubBucketCount) {
+            return static_cast<size_t>(value);
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent >= MaxBits) {
+            return BucketCount - 1;
+        }
+        size_t sub = static_cast<size_t>(value >> (exponent - SubBucketBits)) & (SubBucketCount - 1);
+        return (exponent - SubBucketBits + 1) * SubBucketCount + sub;
+    }
+
+    // Smallest value falling into the bucket
+    static uint64_t getBucketLow(size_t bucket) {
+        if (bucket < SubBucketCount) {
+            return bucket;
+        }
+        int exponent = static_cast<int>(bucket / SubBucketCount) + SubBucketBits - 1;
+        uint64_t sub = bucket % SubBucketCount;
+        return (SubBucketCount + sub) << (exponent - SubBucketBits);
+    }
+
+    friend class HistogramSnapshot;
+
+private:
+    std::atomic<uint64_t> buckets_[BucketCount];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+// Copy of histogram counters, histograms of several workers can be merged
+class HistogramSnapshot {
+public:
+    HistogramSnapshot():
+        buckets_(LatencyHistogram::BucketCount, 0),
+        count_(0),
+        sum_(0),
+        max_(0)
+    { }
+
+    explicit HistogramSnapshot(const LatencyHistogram &histogram):
+        buckets_(LatencyHistogram::BucketCount, 0),
+        count_(0),
+        sum_(histogram.sum_.load(std::memory_order_relaxed)),
+        max_(histogram.max_.load(std::memory_order_relaxed))
+    {
+        // Count is summed from the copied buckets so that percentiles agree
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            buckets_[i] = histogram.buckets_[i].load(std::memory_order_relaxed);
+            count_ += buckets_[i];
+        }
+    }
+
+    void merge(const HistogramSnapshot &other) {
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t getCount() const { return count_; }
+    uint64_t getMax() const { return max_; }
+    double getMean() const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+    // Upper bound of the bucket holding the value at percentile (0..100]
+    uint64_t getPercentile(double percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+        rank = std::max<uint64_t>(1, std::min(rank, count_));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                uint64_t high = (i + 1 < buckets_.size()) ? LatencyHistogram::getBucketLow(i + 1) - 1 : max_;
+                return std::min(high, max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    std::vector<uint64_t> buckets_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+struct WorkerMetrics {
+    uint64_t tasks;
+    uint64_t steals;
+    uint64_t parks;
+    // Share of time spent running tasks since the worker started, only
+    // measured with task timing enabled
+    double utilization;
+    bool running;
+};
+
+// Snapshot of a pool. Times are in nanoseconds
+struct ThreadPoolMetrics {
+    size_t threadCount;
+    // Tasks submitted but not started yet (approximate)
+    size_t queueDepth;
+    uint64_t tasks;
+    uint64_t steals;
+    uint64_t parks;
+    // Submission to start and run times, with task timing enabled
+    HistogramSnapshot waitTime;
+    HistogramSnapshot runTime;
+    std::vector<WorkerMetrics> workers;
+
+    void print(std::ostream &out) const {
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(1)
+            << "threads: " << threadCount << ", queued: " << queueDepth
+            << ", tasks: " << tasks << ", steals: " << steals << ", parks: " << parks << "\n";
+        printHistogram(out, "wait", waitTime);
+        printHistogram(out, "run", runTime);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            if (!workers[i].running && workers[i].tasks == 0) {
+                continue;
+            }
+            out << "  worker " << i << ": tasks " << workers[i].tasks << ", steals " << workers[i].steals
+                << ", parks " << workers[i].parks << ", busy " << workers[i].utilization * 100 << "%\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    static void printHistogram(std::ostream &out, const char *name, const HistogramSnapshot &histogram) {
+        if (histogram.getCount() == 0) {
+            return;
+        }
+        out << "  " << name << " us: mean " << histogram.getMean() / 1000
+            << ", p50 " << histogram.getPercentile(50) / 1000.0
+            << ", p99 " << histogram.getPercentile(99) / 1000.0
+            << ", p99.9 " << histogram.getPercentile(99.9) / 1000.0
+            << ", max " << histogram.getMax() / 1000.0 << "\n";
+    }
+};
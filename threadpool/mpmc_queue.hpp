@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <stdexcept>
+
+// Bounded multi-producer multi-consumer queue (D. Vyukov's ring buffer).
+// Every cell carries a sequence number telling whether it is ready for the
+// producer or for the consumer of the current lap, so push and pop cost one
+// CAS on their position counter and never take a lock.
+template <class T>
+class MpmcQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+public:
+    // Capacity must be a power of two
+    MpmcQueue(size_t capacity):
+        mask_(capacity - 1),
+        cells_(capacity)
+    {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+            throw std::invalid_argument("Capacity must be a power of two (MpmcQueue::MpmcQueue)");
+        }
+        for (size_t i = 0; i < capacity; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueuePos_.store(0, std::memory_order_relaxed);
+        dequeuePos_.store(0, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(const MpmcQueue &rhs) = delete;
+    MpmcQueue &operator= (const MpmcQueue &rhs) = delete;
+
+    size_t getCapacity() const { return mask_ + 1; }
+
+    // Returns false if the queue is full, item is left untouched then
+    bool tryPush(T &&item) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = cells_[pos & mask_];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(item);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Pushes a prefix of count items starting at first into consecutive
+    // cells reserved with one CAS. Returns its length, 0 if the queue is
+    // full. Pushed items are moved from
+    template <class It>
+    size_t tryPushBulk(It first, size_t count) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            size_t free = 0;
+            while (free < count &&
+                   cells_[(pos + free) & mask_].sequence.load(std::memory_order_acquire) == pos + free) {
+                ++free;
+            }
+            if (free == 0) {
+                size_t sequence = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+                if (static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos) < 0) {
+                    return 0;
+                }
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            } else if (enqueuePos_.compare_exchange_weak(pos, pos + free, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < free; ++i, ++first) {
+                    Cell &cell = cells_[(pos + i) & mask_];
+                    cell.data = std::move(*first);
+                    cell.sequence.store(pos + i + 1, std::memory_order_release);
+                }
+                return free;
+            }
+        }
+    }
+
+    // Returns false if the queue is empty
+    bool tryPop(T &item) {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = cells_[pos & mask_];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    item = std::move(cell.data);
+                    cell.data = T();
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate, exact only when no push or pop is in progress
+    size_t size() const {
+        size_t dequeuePos = dequeuePos_.load(std::memory_order_acquire);
+        size_t enqueuePos = enqueuePos_.load(std::memory_order_acquire);
+        return (enqueuePos > dequeuePos) ? enqueuePos - dequeuePos : 0;
+    }
+
+    bool empty() const {
+        return enqueuePos_.load(std::memory_order_acquire) <= dequeuePos_.load(std::memory_order_acquire);
+    }
+
+private:
+    size_t mask_;
+    std::vector<Cell> cells_;
+    // Producers and consumers update different cache lines
+    alignas(64) std::atomic<size_t> enqueuePos_;
+    alignas(64) std::atomic<size_t> dequeuePos_;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Placement of worker threads on NUMA nodes. Topology is read from sysfs,
+// memory placement relies on the kernel first-touch policy: buffers written
+// first by a pinned thread are allocated on its node.
+
+enum class PlacementPolicy {
+    None,    // threads float, scheduler decides
+    Compact, // fill cores of node 0 first, then node 1, ...
+    Scatter  // round-robin over nodes, spreads memory bandwidth
+};
+
+class NumaTopology {
+public:
+    // Detected once per process
+    static const NumaTopology &get() {
+        static NumaTopology topology;
+        return topology;
+    }
+
+    size_t getNodeCount() const { return nodes_.size(); }
+    const std::vector<int> &getNodeCpus(size_t node) const { return nodes_[node]; }
+    size_t getCpuCount() const { return cpus_.size(); }
+
+    size_t getNodeOfCpu(int cpu) const {
+        for (size_t node = 0; node < nodes_.size(); ++node) {
+            if (std::find(nodes_[node].begin(), nodes_[node].end(), cpu) != nodes_[node].end()) {
+                return node;
+            }
+        }
+        return 0;
+    }
+
+    // CPU for index-th thread, -1 if threads must not be pinned
+    int getCpuForThread(size_t index, PlacementPolicy policy) const {
+        if (cpus_.empty()) {
+            return -1;
+        }
+        switch (policy) {
+        case PlacementPolicy::Compact:
+            return cpus_[index % cpus_.size()];
+        case PlacementPolicy::Scatter: {
+            const std::vector<int> &cpus = nodes_[index % nodes_.size()];
+            return cpus[(index / nodes_.size()) % cpus.size()];
+        }
+        default:
+            return -1;
+        }
+    }
+
+    size_t getNodeForThread(size_t index, PlacementPolicy policy) const {
+        int cpu = getCpuForThread(index, policy);
+        return (cpu < 0) ? 0 : getNodeOfCpu(cpu);
+    }
+
+private:
+    NumaTopology() {
+        std::vector<int> allowed = getAllowedCpus();
+        for (size_t node = 0; ; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!file) {
+                break;
+            }
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus;
+            for (int cpu : parseCpuList(list)) {
+                if (allowed.empty() || std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (!cpus.empty()) {
+                nodes_.push_back(cpus);
+            }
+        }
+        if (nodes_.empty()) {
+            // No sysfs information: single node with every allowed CPU
+            if (allowed.empty()) {
+                for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency(); ++cpu) {
+                    allowed.push_back(cpu);
+                }
+            }
+            if (!allowed.empty()) {
+                nodes_.push_back(allowed);
+            }
+        }
+        for (const auto &node : nodes_) {
+            cpus_.insert(cpus_.end(), node.begin(), node.end());
+        }
+    }
+
+    // Parses sysfs list format: "0-3,8,10-11"
+    static std::vector<int> parseCpuList(const std::string &list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            if (range.empty()) {
+                continue;
+            }
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    static std::vector<int> getAllowedCpus() {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        return cpus;
+    }
+
+    std::vector<std::vector<int>> nodes_;
+    std::vector<int> cpus_;
+};
+
+// Pins calling thread to the CPU, returns false if it is not possible
+inline bool pinCurrentThread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+inline bool pinCurrentThread(size_t index, PlacementPolicy policy) {
+    if (policy == PlacementPolicy::None) {
+        return false;
+    }
+    return pinCurrentThread(NumaTopology::get().getCpuForThread(index, policy));
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <iterator>
+#include <exception>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+#include "pool.hpp"
+#include "trace.hpp"
+
+// Data-parallel algorithms on top of ThreadPool. Ranges are split recursively:
+// a task halves its range, posts the upper half and keeps the lower one until
+// it is at most grain long, so idle workers pick up big pieces first and the
+// load balances itself. With work stealing enabled the halves land in the
+// local deque of the splitting worker. Index may be an integer or a random
+// access iterator. The first exception thrown by a body is rethrown to the
+// caller, the remaining unstarted pieces are skipped. Calls may be nested:
+// a worker waiting for its pieces runs other tasks of the pool. Executor is
+// a ThreadPool or a TaskArena (executor.hpp), anything with post(fn),
+// helpUntil(waitFn) and getThreadCount().
+
+// Counts unfinished pieces of one parallel call
+class ForkJoinLatch {
+public:
+    // The caller's own piece is counted from the start
+    ForkJoinLatch():
+        pending_(1),
+        failed_(false),
+        finished_(false)
+    { }
+
+    ForkJoinLatch(const ForkJoinLatch &rhs) = delete;
+    ForkJoinLatch &operator= (const ForkJoinLatch &rhs) = delete;
+
+    void add() { pending_.fetch_add(1, std::memory_order_relaxed); }
+
+    void done() {
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+            condition_.notify_all();
+        }
+    }
+
+    bool isDone() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+    // Waits until every piece called done(), then rethrows the first error.
+    // A worker of the pool keeps running tasks meanwhile (ThreadPool::wait)
+    template <class Executor>
+    void wait(Executor &executor) {
+        executor.helpUntil([this] (std::chrono::microseconds timeout) {
+            return waitFor(timeout);
+        });
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    bool waitFor(std::chrono::microseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return condition_.wait_for(lock, timeout, [this] { return finished_; });
+    }
+
+    void fail(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) {
+            error_ = error;
+        }
+        failed_.store(true, std::memory_order_release);
+    }
+
+    bool isFailed() const { return failed_.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<size_t> pending_;
+    std::atomic<bool> failed_;
+    bool finished_;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+};
+
+// Grain giving about 8 pieces per thread, enough to even out uneven pieces
+template <class Executor>
+size_t getDefaultGrain(const Executor &executor, size_t size) {
+    size_t pieces = 8 * std::max<size_t>(1, executor.getThreadCount());
+    return std::max<size_t>(1, (size + pieces - 1) / pieces);
+}
+
+template <class Executor, class Index, class RangeFn>
+class RangeSplitter {
+public:
+    RangeSplitter(Executor &pool, RangeFn &body, size_t grain):
+        pool_(pool),
+        body_(body),
+        grain_(grain)
+    { }
+
+    // Runs body over [first, last) in pieces and waits for all of them
+    void run(Index first, Index last) {
+        split(first, last);
+        latch_.wait(pool_);
+    }
+
+private:
+    void split(Index first, Index last) {
+        try {
+            while (static_cast<size_t>(last - first) > grain_ && !latch_.isFailed()) {
+                Index middle = first + (last - first) / 2;
+                latch_.add();
+                pool_.post([this, middle, last] { split(middle, last); });
+                last = middle;
+            }
+            if (!latch_.isFailed()) {
+                body_(first, last);
+            }
+        } catch (...) {
+            latch_.fail(std::current_exception());
+        }
+        latch_.done();
+    }
+
+    Executor &pool_;
+    RangeFn &body_;
+    size_t grain_;
+    ForkJoinLatch latch_;
+};
+
+// Calls rangeBody(begin, end) for pieces of [first, last) of at most grain
+// elements, 0 chooses the grain from the thread count
+template <class Executor, class Index, class RangeFn>
+void parallelForRange(Executor &pool, Index first, Index last, RangeFn rangeBody, size_t grain = 0) {
+    if (!(first < last)) {
+        return;
+    }
+    if (grain == 0) {
+        grain = getDefaultGrain(pool, last - first);
+    }
+    RangeSplitter<Executor, Index, RangeFn> splitter(pool, rangeBody, grain);
+    splitter.run(first, last);
+}
+
+// Calls body(i) for every i in [first, last)
+template <class Executor, class Index, class Fn>
+void parallelFor(Executor &pool, Index first, Index last, Fn body, size_t grain = 0) {
+    parallelForRange(pool, first, last, [&body] (Index begin, Index end) {
+        for (Index i = begin; i != end; ++i) {
+            body(i);
+        }
+    }, grain);
+}
+
+// reduce(... reduce(reduce(identity, map(first)), map(first + 1)) ...) computed
+// as partial results of consecutive chunks combined left to right. Chunks
+// depend only on the range, grain and the thread count, so for the same
+// pool size the result is reproducible even for non-associative operations
+// like floating point sums. reduce must be associative, identity neutral.
+template <class Executor, class Index, class T, class MapFn, class ReduceFn>
+T parallelReduce(Executor &pool, Index first, Index last, T identity, MapFn map,
+                 ReduceFn reduce, size_t grain = 0) {
+    if (!(first < last)) {
+        return identity;
+    }
+    size_t size = last - first;
+    if (grain == 0) {
+        grain = getDefaultGrain(pool, size);
+    }
+    size_t chunks = (size + grain - 1) / grain;
+    std::vector<T> partials(chunks, identity);
+    parallelFor(pool, size_t(0), chunks, [&] (size_t chunk) {
+        Index begin = first + chunk * grain;
+        Index end = first + std::min(size, (chunk + 1) * grain);
+        T value = identity;
+        for (Index i = begin; i != end; ++i) {
+            value = reduce(value, map(i));
+        }
+        partials[chunk] = value;
+    }, 1);
+    T result = identity;
+    for (const T &partial : partials) {
+        result = reduce(result, partial);
+    }
+    return result;
+}
+
+// Inclusive prefix scan of [first, last) into out (may be first). Two passes:
+// chunk totals are computed in parallel and scanned sequentially, then every
+// chunk is scanned again starting from the total of the chunks before it.
+// Returns the end of the output range.
+template <class Executor, class RandomIt, class OutputIt, class T, class BinaryOp>
+OutputIt parallelScan(Executor &pool, RandomIt first, RandomIt last, OutputIt out,
+                      T identity, BinaryOp op, size_t grain = 0) {
+    size_t size = std::distance(first, last);
+    if (size == 0) {
+        return out;
+    }
+    if (grain == 0) {
+        grain = getDefaultGrain(pool, size);
+    }
+    size_t chunks = (size + grain - 1) / grain;
+    std::vector<T> offsets(chunks + 1, identity);
+    parallelFor(pool, size_t(0), chunks, [&] (size_t chunk) {
+        RandomIt end = first + std::min(size, (chunk + 1) * grain);
+        T total = identity;
+        for (RandomIt it = first + chunk * grain; it != end; ++it) {
+            total = op(total, *it);
+        }
+        offsets[chunk + 1] = total;
+    }, 1);
+    for (size_t chunk = 1; chunk <= chunks; ++chunk) {
+        offsets[chunk] = op(offsets[chunk - 1], offsets[chunk]);
+    }
+    parallelFor(pool, size_t(0), chunks, [&] (size_t chunk) {
+        size_t begin = chunk * grain;
+        size_t end = std::min(size, begin + grain);
+        T value = offsets[chunk];
+        OutputIt dest = out + begin;
+        for (RandomIt it = first + begin; it != first + end; ++it, ++dest) {
+            value = op(value, *it);
+            *dest = value;
+        }
+    }, 1);
+    return out + size;
+}
+
+template <class Executor, class RandomIt, class Compare>
+class ParallelSorter {
+    typedef typename std::iterator_traits<RandomIt>::value_type T;
+public:
+    ParallelSorter(Executor &pool, Compare cmp, size_t grain):
+        pool_(pool),
+        cmp_(cmp),
+        grain_(grain)
+    { }
+
+    void run(RandomIt first, RandomIt last) {
+        sort(first, last);
+        latch_.wait(pool_);
+    }
+
+private:
+    // Three-way partition around median of three, the part above the pivot
+    // is posted, the part below is sorted in place
+    void sort(RandomIt first, RandomIt last) {
+        try {
+            TRACE_SPAN("parallelSort task", "parallel", "size", last - first);
+            while (static_cast<size_t>(last - first) > grain_ && !latch_.isFailed()) {
+                T pivot = medianOfThree(*first, *(first + (last - first) / 2), *(last - 1));
+                RandomIt middle1 = std::partition(first, last, [this, &pivot] (const T &item) {
+                    return cmp_(item, pivot);
+                });
+                RandomIt middle2 = std::partition(middle1, last, [this, &pivot] (const T &item) {
+                    return !cmp_(pivot, item);
+                });
+                if (middle2 != last) {
+                    latch_.add();
+                    pool_.post([this, middle2, last] { sort(middle2, last); });
+                }
+                last = middle1;
+            }
+            if (!latch_.isFailed()) {
+                std::sort(first, last, cmp_);
+            }
+        } catch (...) {
+            latch_.fail(std::current_exception());
+        }
+        latch_.done();
+    }
+
+    const T &medianOfThree(const T &a, const T &b, const T &c) const {
+        if (cmp_(a, b)) {
+            return cmp_(b, c) ? b : (cmp_(a, c) ? c : a);
+        }
+        return cmp_(a, c) ? a : (cmp_(b, c) ? c : b);
+    }
+
+    Executor &pool_;
+    Compare cmp_;
+    size_t grain_;
+    ForkJoinLatch latch_;
+};
+
+// Parallel quicksort, pieces of at most grain elements (at least 2048 by
+// default) are finished with std::sort. Not stable.
+template <class Executor, class RandomIt,
+          class Compare = std::less<typename std::iterator_traits<RandomIt>::value_type>>
+void parallelSort(Executor &pool, RandomIt first, RandomIt last, Compare cmp = Compare(),
+                  size_t grain = 0) {
+    if (last - first < 2) {
+        return;
+    }
+    if (grain == 0) {
+        grain = std::max<size_t>(2048, getDefaultGrain(pool, last - first));
+    }
+    ParallelSorter<Executor, RandomIt, Compare> sorter(pool, cmp, grain);
+    sorter.run(first, last);
+}
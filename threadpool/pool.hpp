@@ -2,58 +2,341 @@
 
 #include <thread>
 #include <vector>
+#include <iterator>
 #include <queue>
 #include <future>
+#include <functional>
 #include <algorithm>
 #include <type_traits>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <exception>
+#include <chrono>
+#include <climits>
+#include <unordered_map>
 
-class FunctionWrapper {
-private:
-    typedef std::function<void()> _Proc;
+#include "trace.hpp"
+#include "numa.hpp"
+#include "work_stealing_deque.hpp"
+#include "mpmc_queue.hpp"
+#include "event_count.hpp"
+#include "task.hpp"
+#include "future_state.hpp"
+#include "metrics.hpp"
+#include "../priority_queue/priority_queue_binary.hpp"
+
+template <class T> using FutureVector = std::vector<std::future<T>>;
+
+// Priority classes for ThreadPool::addTask, any other int works as well
+enum class TaskPriority {
+    Low = -1,
+    Normal = 0,
+    High = 1
+};
+
+class ThreadPoolOptions {
 public:
- 
-    template <class Fn, class Ret>
-    static _Proc makeProc(std::future<Ret> &result, Fn task) {
-        std::shared_ptr<std::promise<Ret>> promise = std::make_shared<std::promise<Ret>>();
-        result = promise->get_future();
-        return [task, promise] {
-            try {
-                promise->set_value(task());
-            } catch (const std::exception &ex) {
-                promise->set_exception(std::current_exception());
-            }
-        }; 
+    ThreadPoolOptions():
+        placement_(PlacementPolicy::None),
+        workStealing_(false),
+        queueCapacity_(4096),
+        agingQuantum_(std::chrono::milliseconds(10)),
+        maxThreadCount_(0),
+        idleTimeout_(std::chrono::seconds(5)),
+        latencyThreshold_(std::chrono::milliseconds(10)),
+        taskTiming_(false),
+        spinCount_(0),
+        yieldCount_(0)
+    { }
+
+    // Pins i-th worker to the CPU chosen by the policy (see numa.hpp)
+    void setPlacementPolicy(PlacementPolicy placement) { placement_ = placement; }
+    PlacementPolicy getPlacementPolicy() const { return placement_; }
+
+    // Tasks added from inside a worker go to its own deque (LIFO), idle
+    // workers steal from random victims. Suits recursive fork-join work
+    void setWorkStealing(bool enabled) { workStealing_ = enabled; }
+    bool isWorkStealing() const { return workStealing_; }
+
+    // Slots of the lock-free submission ring, power of two. Tasks added while
+    // the ring is full wait in a locked overflow queue
+    void setQueueCapacity(size_t capacity) {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+            throw std::invalid_argument("Capacity must be a power of two (ThreadPoolOptions::setQueueCapacity)");
+        }
+        queueCapacity_ = capacity;
     }
+    size_t getQueueCapacity() const { return queueCapacity_; }
 
-    template <class Fn>
-    static _Proc makeProc(std::future<void> &result, Fn task) {
-        std::shared_ptr<std::promise<void>> promise = std::make_shared<std::promise<void>>();
-        result = promise->get_future();
-        return [task, promise] {
-            try {
-                task();
-                promise->set_value();
-            } catch (const std::exception &ex) {
-                promise->set_exception(std::current_exception());
-            }
-        };
+    // Prioritized tasks are ordered by virtual deadline: submission time
+    // minus priority * quantum. Plain tasks have priority 0, their deadline
+    // is the submission time. A task waits at most priority * quantum behind
+    // ones with higher priority, whatever the rate they come at
+    void setAgingQuantum(std::chrono::microseconds quantum) {
+        if (quantum.count() <= 0) {
+            throw std::invalid_argument("Quantum must be positive (ThreadPoolOptions::setAgingQuantum)");
+        }
+        agingQuantum_ = quantum;
     }
+    std::chrono::microseconds getAgingQuantum() const { return agingQuantum_; }
 
-};
+    // Elastic mode: the pool starts with threadsCount workers and grows up to
+    // count when queued tasks wait longer than the latency threshold or some
+    // workers are inside BlockingScope. Extra workers exit after being idle
+    // for the idle timeout. 0 (default) or count <= threadsCount: fixed size
+    void setMaxThreadCount(size_t count) { maxThreadCount_ = count; }
+    size_t getMaxThreadCount() const { return maxThreadCount_; }
 
-template <class T> using FutureVector = std::vector<std::future<T>>;
+    void setIdleTimeout(std::chrono::microseconds timeout) {
+        if (timeout.count() <= 0) {
+            throw std::invalid_argument("Timeout must be positive (ThreadPoolOptions::setIdleTimeout)");
+        }
+        idleTimeout_ = timeout;
+    }
+    std::chrono::microseconds getIdleTimeout() const { return idleTimeout_; }
+
+    void setQueueLatencyThreshold(std::chrono::microseconds threshold) {
+        if (threshold.count() <= 0) {
+            throw std::invalid_argument("Threshold must be positive (ThreadPoolOptions::setQueueLatencyThreshold)");
+        }
+        latencyThreshold_ = threshold;
+    }
+    std::chrono::microseconds getQueueLatencyThreshold() const { return latencyThreshold_; }
+
+    // Wait and run time histograms and worker utilization in getMetrics().
+    // Costs three clock reads per task, counters are always kept
+    void setTaskTiming(bool enabled) { taskTiming_ = enabled; }
+    bool isTaskTiming() const { return taskTiming_; }
+
+    // Idle strategy: a worker out of tasks polls the queues up to count
+    // times with a pause instruction in between, then yields its CPU up to
+    // yield count times, and only then parks. A task found while spinning
+    // starts without a kernel wakeup, at the cost of idle CPU. Each worker
+    // adapts its own budget within count: it doubles after spinning found a
+    // task and halves after the worker had to park. 0 (default): park at once
+    void setSpinCount(size_t count) { spinCount_ = count; }
+    size_t getSpinCount() const { return spinCount_; }
+
+    void setYieldCount(size_t count) { yieldCount_ = count; }
+    size_t getYieldCount() const { return yieldCount_; }
+
+private:
+    PlacementPolicy placement_;
+    bool workStealing_;
+    size_t queueCapacity_;
+    std::chrono::microseconds agingQuantum_;
+    size_t maxThreadCount_;
+    std::chrono::microseconds idleTimeout_;
+    std::chrono::microseconds latencyThreshold_;
+    bool taskTiming_;
+    size_t spinCount_;
+    size_t yieldCount_;
+};
 
 class ThreadPool {
 private:
-    typedef std::function<void()> _TaskType;
+    typedef std::chrono::steady_clock _Clock;
+
+    // Task with its submission time in nanoseconds, set with task timing
+    // enabled or once the pool has got a prioritized task. 0 when unset
+    struct QueuedTask {
+        QueuedTask(): submitted(0) { }
+
+        template <class Fn, class = typename std::enable_if<
+            !std::is_same<typename std::decay<Fn>::type, QueuedTask>::value>::type>
+        QueuedTask(Fn &&fn):
+            task(std::forward<Fn>(fn)),
+            submitted(0)
+        { }
+
+        void reset() { task.reset(); }
+
+        Task task;
+        long long submitted;
+    };
+
+    typedef QueuedTask _TaskType;
+    // Virtual deadline in nanoseconds (enqueue time - priority * quantum) and sequence number
+    typedef std::pair<long long, unsigned long long> _PriorityKey;
+    // std::greater puts the earliest deadline on top
+    typedef PriorityQueueBinary<size_t, _PriorityKey, std::greater<_PriorityKey>> _PriorityQueue;
+
 public:
-    
-    ThreadPool(size_t threadsCount = std::thread::hardware_concurrency()):
-        closingFlag_(false)  
+    // Identifies a delayed or periodic task for cancelTimer, never 0
+    typedef unsigned long long TimerId;
+
+private:
+    // Timer heap holds (deadline in nanoseconds, sequence number)
+    typedef PriorityQueueBinary<TimerId, _PriorityKey, std::greater<_PriorityKey>> _TimerQueue;
+    // nextTimerDeadline_ when there are no timers
+    static const long long NoTimer = LLONG_MAX;
+
+    struct Timer {
+        Timer(): interval(0), deadline(0) { }
+
+        // Shared with a running periodic task, so the timer may be cancelled meanwhile
+        std::shared_ptr<Task> task;
+        // Nanoseconds, 0 for a one-shot timer
+        long long interval;
+        long long deadline;
+        // Heap entry, invalid while the periodic task runs
+        PriorityQueueHandle node;
+    };
+
+    // Runs a periodic task and schedules its next run afterwards
+    struct PeriodicRun {
+        void operator()() {
+            (*task)();
+            pool->rescheduleTimer(id);
+        }
+
+        ThreadPool *pool;
+        TimerId id;
+        std::shared_ptr<Task> task;
+    };
+
+    // Shared by the tasks of addBatch, the last one to finish sets the result
+    struct BatchState {
+        BatchState(): remaining(0) { }
+
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::exception_ptr error;
+        std::promise<void> done;
+    };
+
+    template <class Fn>
+    struct BatchTask {
+        void operator()() {
+            try {
+                fn();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error) {
+                    state->error = std::current_exception();
+                }
+            }
+            if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (state->error) {
+                    state->done.set_exception(state->error);
+                } else {
+                    state->done.set_value();
+                }
+            }
+        }
+
+        std::shared_ptr<BatchState> state;
+        Fn fn;
+    };
+
+    struct Worker {
+        // Spare deque nodes kept per worker
+        static const size_t MaxFreeNodes = 1024;
+
+        Worker(ThreadPool *owner, size_t workerIndex):
+            pool(owner),
+            index(workerIndex),
+            random(static_cast<unsigned>(workerIndex) * 2654435761u + 1),
+            running(false),
+            tasks(0),
+            steals(0),
+            parks(0),
+            busyTime(0),
+            startTime(0),
+            spinBudget(pool->options_.getSpinCount())
+        { }
+
+        // Counters have a single writer, the worker's thread
+        static void increment(std::atomic<uint64_t> &counter, uint64_t value = 1) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        ~Worker() {
+            for (_TaskType *node : freeNodes) {
+                delete node;
+            }
+        }
+
+        // Nodes are taken and returned only by the worker's own thread: the
+        // pusher allocates, whoever runs the task (owner or thief) recycles
+        _TaskType *acquireNode(_TaskType &&task) {
+            if (freeNodes.empty()) {
+                return new _TaskType(std::move(task));
+            }
+            _TaskType *node = freeNodes.back();
+            freeNodes.pop_back();
+            *node = std::move(task);
+            return node;
+        }
+
+        void releaseNode(_TaskType *node) {
+            if (freeNodes.size() < MaxFreeNodes) {
+                freeNodes.push_back(node);
+            } else {
+                delete node;
+            }
+        }
+
+        ThreadPool *pool;
+        size_t index;
+        unsigned random;
+        WorkStealingDeque<_TaskType *> deque;
+        std::vector<_TaskType *> freeNodes;
+        // Slot has a live thread. In elastic mode slots are created for the
+        // maximum number of threads and started on demand
+        std::atomic<bool> running;
+        std::thread thread;
+
+        std::atomic<uint64_t> tasks;
+        std::atomic<uint64_t> steals;
+        std::atomic<uint64_t> parks;
+        // Nanoseconds, with task timing enabled
+        std::atomic<uint64_t> busyTime;
+        std::atomic<long long> startTime;
+        LatencyHistogram waitTime;
+        LatencyHistogram runTime;
+        // Current spin count of the idle strategy
+        size_t spinBudget;
+    };
+
+    friend class BlockingScope;
+
+public:
+
+    ThreadPool(size_t threadsCount = std::thread::hardware_concurrency(),
+               const ThreadPoolOptions &options = ThreadPoolOptions()):
+        options_(options),
+        queue_(options.getQueueCapacity()),
+        overflowSize_(0),
+        prioritySize_(0),
+        prioritySequence_(0),
+        priorityUsed_(false),
+        minThreadCount_(threadsCount),
+        activeCount_(0),
+        blockedCount_(0),
+        probePending_(false),
+        nextTimerId_(0),
+        timerSequence_(0),
+        nextTimerDeadline_(NoTimer),
+        timerKeeper_(false),
+        closingFlag_(false)
     {
-        for (size_t i = 0; i < threadsCount; ++i) {
-            threads_.emplace_back(std::bind(&ThreadPool::threadProc, this));
+        size_t slots = threadsCount;
+        if (isElastic()) {
+            minThreadCount_ = std::max<size_t>(1, threadsCount);
+            slots = options.getMaxThreadCount();
+        }
+        for (size_t i = 0; i < slots; ++i) {
+            workers_.emplace_back(new Worker(this, i));
+        }
+        for (size_t i = 0; i < minThreadCount_; ++i) {
+            startWorker(*workers_[i]);
+        }
+        if (isElastic()) {
+            supervisor_ = std::thread(std::bind(&ThreadPool::supervisorProc, this));
         }
     }
 
@@ -61,22 +344,217 @@ public:
     ThreadPool &operator= (const ThreadPool &rhs) = delete;
 
     ~ThreadPool() {
-        setClosingFlag();
-        std::for_each(threads_.begin(), threads_.end(), 
-                std::mem_fn(&std::thread::join));
+        {
+            std::unique_lock<std::mutex> lock(supervisorMutex_);
+            closingFlag_.store(true, std::memory_order_release);
+            supervisorCondition_.notify_all();
+        }
+        if (supervisor_.joinable()) {
+            supervisor_.join();
+        }
+        eventCount_.notifyAll();
+        for (auto &worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
     }
 
+    // Callable may be move-only. The shared state of the future comes from
+    // FutureStatePool, so in steady state the only allocation is that of a
+    // callable that does not fit in the task next to its promise
     template <class Fn>
     std::future<typename std::result_of<Fn()>::type> addTask(Fn task) {
-        std::future<typename std::result_of<Fn()>::type> result;
-        std::unique_lock<std::mutex> lock(conditionMutex_);
-        queue_.push(FunctionWrapper::makeProc(result, task));
-        condition_.notify_one();
+        typedef PromiseTask<Fn> Promised;
+        Promised promised = {Promised::makePromise(), std::move(task)};
+        std::future<typename std::result_of<Fn()>::type> result = promised.promise.get_future();
+        submit(_TaskType(std::move(promised)));
         return result;
     }
+
+    // Fire-and-forget: no future, no allocation if the callable fits in
+    // Task::InlineSize. Task must not throw
+    template <class Fn>
+    void post(Fn task) {
+        submit(_TaskType(std::move(task)));
+    }
+
+    // Adds the callables of [first, last) at once: one reservation of slots
+    // in the queue and one wakeup of at most as many workers as there are
+    // tasks. Callables are moved from the range
+    template <class InputIt>
+    FutureVector<typename std::result_of<typename std::iterator_traits<InputIt>::value_type()>::type>
+    addTasks(InputIt first, InputIt last) {
+        typedef typename std::result_of<typename std::iterator_traits<InputIt>::value_type()>::type Ret;
+        FutureVector<Ret> results;
+        std::vector<_TaskType> tasks;
+        typedef PromiseTask<typename std::iterator_traits<InputIt>::value_type> Promised;
+        for (; first != last; ++first) {
+            Promised promised = {Promised::makePromise(), std::move(*first)};
+            results.push_back(promised.promise.get_future());
+            tasks.push_back(_TaskType(std::move(promised)));
+        }
+        submit(std::move(tasks));
+        return results;
+    }
+
+    // Like addTasks, with one future for the whole batch instead of a
+    // promise per task. It is ready once every task has finished and holds
+    // the first exception thrown, if any. Results of the callables are dropped
+    template <class InputIt>
+    std::future<void> addBatch(InputIt first, InputIt last) {
+        typedef typename std::iterator_traits<InputIt>::value_type Fn;
+        std::shared_ptr<BatchState> state = std::make_shared<BatchState>();
+        std::future<void> result = state->done.get_future();
+        std::vector<_TaskType> tasks;
+        for (; first != last; ++first) {
+            // Nothing runs before submit, so the count needs no synchronization yet
+            state->remaining.fetch_add(1, std::memory_order_relaxed);
+            BatchTask<Fn> batchTask = {state, std::move(*first)};
+            tasks.push_back(_TaskType(std::move(batchTask)));
+        }
+        if (tasks.empty()) {
+            state->done.set_value();
+            return result;
+        }
+        submit(std::move(tasks));
+        return result;
+    }
+
+    // Tasks ordered by priority with aging (see ThreadPoolOptions::setAgingQuantum).
+    // Priority 0 is the same as addTask without priority
+    template <class Fn>
+    std::future<typename std::result_of<Fn()>::type> addTask(int priority, Fn task) {
+        typedef PromiseTask<Fn> Promised;
+        Promised promised = {Promised::makePromise(), std::move(task)};
+        std::future<typename std::result_of<Fn()>::type> result = promised.promise.get_future();
+        if (priority == 0) {
+            submit(_TaskType(std::move(promised)));
+        } else {
+            submitPriority(priority, _TaskType(std::move(promised)));
+        }
+        return result;
+    }
+
+    template <class Fn>
+    std::future<typename std::result_of<Fn()>::type> addTask(TaskPriority priority, Fn task) {
+        return addTask(static_cast<int>(priority), std::move(task));
+    }
+
+    // Posts task to the pool once delay has passed. Timers are checked by the
+    // workers between tasks, one parked worker sleeps until the earliest
+    // deadline, so there is no timer thread. A task is late when all workers
+    // are busy with long tasks. Like post, task must not throw. Timers still
+    // pending when the pool is destroyed are dropped
+    template <class Fn>
+    TimerId addDelayedTask(std::chrono::microseconds delay, Fn task) {
+        return addTimer(std::max<long long>(0, delay.count()) * 1000, 0, Task(std::move(task)));
+    }
+
+    // Runs task every interval, the first time after one interval. Runs of
+    // one timer never overlap: the next one is scheduled when the previous
+    // finishes, runs missed meanwhile are skipped
+    template <class Fn>
+    TimerId addPeriodicTask(std::chrono::microseconds interval, Fn task) {
+        if (interval.count() <= 0) {
+            throw std::invalid_argument("Interval must be positive (ThreadPool::addPeriodicTask)");
+        }
+        return addTimer(interval.count() * 1000, interval.count() * 1000, Task(std::move(task)));
+    }
+
+    // Awaitable of schedule() and scheduleAfter(). Handle is a
+    // std::coroutine_handle, the pool itself does not need C++20
+    class ScheduleAwaiter {
+    public:
+        ScheduleAwaiter(ThreadPool &pool, std::chrono::microseconds delay):
+            pool_(pool),
+            delay_(delay)
+        { }
+
+        bool await_ready() const { return false; }
+
+        template <class Handle>
+        void await_suspend(Handle handle) {
+            if (delay_.count() > 0) {
+                pool_.addDelayedTask(delay_, [handle] () mutable { handle.resume(); });
+            } else {
+                pool_.post([handle] () mutable { handle.resume(); });
+            }
+        }
+
+        void await_resume() const { }
+
+    private:
+        ThreadPool &pool_;
+        std::chrono::microseconds delay_;
+    };
+
+    // co_await pool.schedule() resumes the coroutine on a worker of the
+    // pool, always through the queue, even when called from one
+    ScheduleAwaiter schedule() {
+        return ScheduleAwaiter(*this, std::chrono::microseconds(0));
+    }
+
+    // Resumes on a worker after delay without occupying any thread meanwhile
+    ScheduleAwaiter scheduleAfter(std::chrono::microseconds delay) {
+        return ScheduleAwaiter(*this, delay);
+    }
+
+    // False if the timer has already fired (one-shot) or was cancelled.
+    // A periodic task running at the moment finishes, but never runs again
+    bool cancelTimer(TimerId id) {
+        std::unique_lock<std::mutex> lock(timerMutex_);
+        auto it = timers_.find(id);
+        if (it == timers_.end()) {
+            return false;
+        }
+        if (timerQueue_.isValid(it->second.node)) {
+            // Moved to the top to be extracted
+            timerQueue_.updatePriority(it->second.node, _PriorityKey(LLONG_MIN, 0));
+            timerQueue_.extractTop();
+            updateNextTimerDeadline();
+        }
+        timers_.erase(it);
+        return true;
+    }
     
+    // Current number of workers, changes over time in elastic mode
     size_t getThreadCount() const {
-        return threads_.size();
+        return activeCount_.load(std::memory_order_relaxed);
+    }
+
+    bool isElastic() const {
+        return options_.getMaxThreadCount() > minThreadCount_;
+    }
+
+    const ThreadPoolOptions &getOptions() const { return options_; }
+
+    // Counters and histograms of all workers, may be called at any time
+    ThreadPoolMetrics getMetrics() const {
+        ThreadPoolMetrics metrics;
+        metrics.threadCount = getThreadCount();
+        metrics.queueDepth = queue_.size() + overflowSize_.load(std::memory_order_relaxed) +
+            prioritySize_.load(std::memory_order_relaxed);
+        metrics.tasks = metrics.steals = metrics.parks = 0;
+        long long now = getTime();
+        for (const auto &worker : workers_) {
+            metrics.queueDepth += worker->deque.size();
+            WorkerMetrics stats;
+            stats.tasks = worker->tasks.load(std::memory_order_relaxed);
+            stats.steals = worker->steals.load(std::memory_order_relaxed);
+            stats.parks = worker->parks.load(std::memory_order_relaxed);
+            stats.running = worker->running.load(std::memory_order_relaxed);
+            long long lifetime = now - worker->startTime.load(std::memory_order_relaxed);
+            stats.utilization = (stats.running && lifetime > 0) ?
+                std::min(1.0, static_cast<double>(worker->busyTime.load(std::memory_order_relaxed)) / lifetime) : 0.0;
+            metrics.tasks += stats.tasks;
+            metrics.steals += stats.steals;
+            metrics.parks += stats.parks;
+            metrics.workers.push_back(stats);
+            metrics.waitTime.merge(HistogramSnapshot(worker->waitTime));
+            metrics.runTime.merge(HistogramSnapshot(worker->runTime));
+        }
+        return metrics;
     }
 
     template <class T>
@@ -84,38 +562,690 @@ public:
         std::for_each(fv.begin(), fv.end(), std::mem_fn(&std::future<T>::wait));
     }
 
+    // Waits for a result of this pool's task. Called from a worker, runs
+    // other pending tasks meanwhile instead of blocking the thread, so tasks
+    // may wait for each other without deadlocking or idling the pool
+    template <class T>
+    void wait(const std::future<T> &future) {
+        helpUntil([&future] (std::chrono::microseconds timeout) {
+            return future.wait_for(timeout) == std::future_status::ready;
+        });
+    }
+
+    template <class T>
+    void wait(const FutureVector<T> &fv) {
+        for (const auto &future : fv) {
+            wait(future);
+        }
+    }
+
+    bool isWorkerThread() const {
+        Worker *worker = currentWorker();
+        return worker && worker->pool == this;
+    }
+
+    // Runs tasks of this pool until waitFor(timeout) returns true. waitFor
+    // blocks for at most timeout and reports whether the awaited event has
+    // happened. Outside of workers it only blocks
+    template <class WaitFn>
+    void helpUntil(WaitFn waitFor) {
+        if (!isWorkerThread()) {
+            while (!waitFor(std::chrono::microseconds(100000))) { }
+            return;
+        }
+        // How long a helper blocks when it found nothing to run
+        const std::chrono::microseconds pollInterval(50);
+        Worker &self = *currentWorker();
+        _TaskType task;
+        while (!waitFor(std::chrono::microseconds(0))) {
+            if (tryExtractTask(self, task)) {
+                runTask(self, task);
+            } else if (waitFor(pollInterval)) {
+                // Nothing to run: the awaited task is running elsewhere
+                return;
+            }
+        }
+    }
+
 private:
 
-    void threadProc() {
+    static Worker *&currentWorker() {
+        static thread_local Worker *worker = nullptr;
+        return worker;
+    }
+
+    void threadProc(Worker *worker) {
+        currentWorker() = worker;
+        pinCurrentThread(worker->index, options_.getPlacementPolicy());
         _TaskType task;
-        while (extractTop(task)) {
-            task();
+        while (extractTask(*worker, task)) {
+            runTask(*worker, task);
         }
+        currentWorker() = nullptr;
+        worker->running.store(false, std::memory_order_release);
     }
 
-    bool extractTop(_TaskType &out) {
-        std::unique_lock<std::mutex> lock(conditionMutex_);
-        condition_.wait(lock, [this]() -> bool {
-            return !queue_.empty() || closingFlag_;
-        });
-        if (!queue_.empty()) {
-            out = queue_.front();
-            queue_.pop();
+    // Never blocks. The plain candidate comes from the own deque, the global
+    // queue or other deques. While priority tasks are pending it competes
+    // with the priority top, which runs first if its deadline is earlier
+    // than the submission time of the candidate. The candidate is then put
+    // back, so other workers can still take it
+    bool tryExtractTask(Worker &self, _TaskType &out) {
+        if (nextTimerDeadline_.load(std::memory_order_relaxed) != NoTimer) {
+            fireDueTimers();
+        }
+        if (!popPlain(self, out)) {
+            return popPriority(out, LLONG_MAX);
+        }
+        if (prioritySize_.load(std::memory_order_acquire) == 0) {
+            return true;
+        }
+        _TaskType priority;
+        if (popPriority(priority, out.submitted)) {
+            putBack(self, std::move(out));
+            out = std::move(priority);
+        }
+        return true;
+    }
+
+    // Keeps the submission time, so the task keeps its age
+    void putBack(Worker &self, _TaskType &&task) {
+        if (options_.isWorkStealing()) {
+            self.deque.push(self.acquireNode(std::move(task)));
+        } else {
+            pushGlobal(std::move(task));
+        }
+        // Parked workers may have seen the queues empty meanwhile
+        eventCount_.notifyOne();
+    }
+
+    bool popPlain(Worker &self, _TaskType &out) {
+        _TaskType *task;
+        if (options_.isWorkStealing() && self.deque.pop(task)) {
+            out = std::move(*task);
+            self.releaseNode(task);
+            return true;
+        }
+        if (popGlobal(out)) {
+            return true;
+        }
+        if (options_.isWorkStealing() && stealTask(self, task)) {
+            out = std::move(*task);
+            self.releaseNode(task);
+            Worker::increment(self.steals);
             return true;
         }
         return false;
     }
 
-    void setClosingFlag() {
-        std::unique_lock<std::mutex> lock(conditionMutex_);
-        closingFlag_ = true;
-        condition_.notify_all();
+    // Parks the worker until a task arrives. False when the pool is closing
+    // or an elastic pool retires the worker after the idle timeout. While
+    // there are timers, one parked worker (the keeper) wakes up at the
+    // earliest deadline to fire it
+    bool extractTask(Worker &self, _TaskType &out) {
+        while (true) {
+            if (tryExtractTask(self, out)) {
+                return true;
+            }
+            if (spinUntilTask(self)) {
+                continue;
+            }
+            EventCount::Key key = eventCount_.prepareWait();
+            if (popGlobal(out) || popPriority(out, LLONG_MAX)) {
+                eventCount_.cancelWait();
+                return true;
+            }
+            if (options_.isWorkStealing() && hasStealableTask()) {
+                eventCount_.cancelWait();
+                continue;
+            }
+            if (closingFlag_.load(std::memory_order_acquire)) {
+                eventCount_.cancelWait();
+                return false;
+            }
+            Worker::increment(self.parks);
+            // Read after prepareWait: an earlier timer added later notifies us
+            long long timerDeadline = nextTimerDeadline_.load(std::memory_order_acquire);
+            bool keeper = timerDeadline != NoTimer && !timerKeeper_.exchange(true, std::memory_order_acquire);
+            bool mayRetire = isElastic() && activeCount_.load(std::memory_order_relaxed) > minThreadCount_;
+            if (!keeper && !mayRetire) {
+                eventCount_.commitWait(key);
+                continue;
+            }
+            std::chrono::microseconds timeout = options_.getIdleTimeout();
+            bool idle = mayRetire;
+            if (keeper) {
+                // Rounded up, waking before the deadline would find nothing
+                std::chrono::microseconds untilTimer((timerDeadline - getTime()) / 1000 + 1);
+                if (!mayRetire || untilTimer < timeout) {
+                    timeout = untilTimer;
+                    idle = false;
+                }
+            }
+            bool notified = eventCount_.commitWaitFor(key, timeout);
+            bool retire = !notified && idle && tryRetire();
+            if (keeper) {
+                timerKeeper_.store(false, std::memory_order_release);
+                if (notified || retire) {
+                    // Leaving for other work, another parked worker takes over
+                    eventCount_.notifyOne();
+                }
+            }
+            if (retire) {
+                return false;
+            }
+        }
     }
 
-    std::vector<std::thread> threads_;
-    std::queue<_TaskType> queue_;
-    std::mutex conditionMutex_;
-    std::condition_variable condition_;
-    bool closingFlag_;
+    // Idle strategy, see ThreadPoolOptions::setSpinCount. True if a task
+    // showed up before the budget ran out
+    bool spinUntilTask(Worker &self) {
+        size_t spinCount = options_.getSpinCount();
+        size_t yieldCount = options_.getYieldCount();
+        if (spinCount == 0 && yieldCount == 0) {
+            return false;
+        }
+        bool found = false;
+        for (size_t i = 0; i < self.spinBudget && !found && !isClosing(); ++i) {
+            cpuRelax();
+            found = hasPendingTask() || isTimerDue();
+        }
+        for (size_t i = 0; i < yieldCount && !found && !isClosing(); ++i) {
+            std::this_thread::yield();
+            found = hasPendingTask() || isTimerDue();
+        }
+        // Never below MinSpinBudget, so that the budget can grow again
+        const size_t MinSpinBudget = std::min<size_t>(16, spinCount);
+        if (found) {
+            self.spinBudget = std::min(spinCount, std::max<size_t>(1, self.spinBudget * 2));
+        } else {
+            self.spinBudget = std::max(MinSpinBudget, self.spinBudget / 2);
+        }
+        return found;
+    }
+
+    bool isClosing() const {
+        return closingFlag_.load(std::memory_order_relaxed);
+    }
+
+    static void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+
+    // Keeps at least minThreadCount_ workers
+    bool tryRetire() {
+        size_t active = activeCount_.load(std::memory_order_relaxed);
+        while (active > minThreadCount_) {
+            if (activeCount_.compare_exchange_weak(active, active - 1, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Called by the constructor and the supervisor only
+    void startWorker(Worker &worker) {
+        if (worker.thread.joinable()) {
+            // Retired thread, it has finished or is about to
+            worker.thread.join();
+        }
+        worker.running.store(true, std::memory_order_relaxed);
+        worker.startTime.store(getTime(), std::memory_order_relaxed);
+        worker.busyTime.store(0, std::memory_order_relaxed);
+        activeCount_.fetch_add(1, std::memory_order_relaxed);
+        worker.thread = std::thread(std::bind(&ThreadPool::threadProc, this, &worker));
+    }
+
+    // Elastic mode: checks every half latency threshold whether a worker
+    // should be added. Queue latency is measured by a probe task going
+    // through the global queue
+    void supervisorProc() {
+        std::chrono::microseconds period = std::max<std::chrono::microseconds>(
+            std::chrono::milliseconds(1), options_.getQueueLatencyThreshold() / 2);
+        _Clock::time_point probeSubmitted;
+        std::unique_lock<std::mutex> lock(supervisorMutex_);
+        while (!closingFlag_.load(std::memory_order_acquire)) {
+            supervisorCondition_.wait_for(lock, period);
+            if (closingFlag_.load(std::memory_order_acquire)) {
+                break;
+            }
+            bool grow = false;
+            if (probePending_.load(std::memory_order_acquire)) {
+                grow = _Clock::now() - probeSubmitted > options_.getQueueLatencyThreshold();
+            } else if (hasPendingTask()) {
+                // Empty queue has no latency, probing it would keep idle workers awake
+                probePending_.store(true, std::memory_order_relaxed);
+                probeSubmitted = _Clock::now();
+                pushGlobal(_TaskType([this] {
+                    probePending_.store(false, std::memory_order_release);
+                }));
+                eventCount_.notifyOne();
+            }
+            size_t active = activeCount_.load(std::memory_order_relaxed);
+            size_t blocked = blockedCount_.load(std::memory_order_relaxed);
+            if (active < minThreadCount_ + blocked && hasPendingTask()) {
+                grow = true;
+            }
+            if (grow && active < workers_.size()) {
+                for (auto &worker : workers_) {
+                    if (!worker->running.load(std::memory_order_acquire)) {
+                        startWorker(*worker);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    bool hasPendingTask() const {
+        return !queue_.empty() || overflowSize_.load(std::memory_order_relaxed) != 0 ||
+            prioritySize_.load(std::memory_order_relaxed) != 0 || hasStealableTask();
+    }
+
+    void beginBlocking() {
+        blockedCount_.fetch_add(1, std::memory_order_relaxed);
+        if (isElastic()) {
+            // Replacement is started without waiting for the next check
+            std::unique_lock<std::mutex> lock(supervisorMutex_);
+            supervisorCondition_.notify_one();
+        }
+    }
+
+    void endBlocking() {
+        blockedCount_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void runTask(Worker &self, _TaskType &task) {
+        if (options_.isTaskTiming()) {
+            long long start = getTime();
+            self.waitTime.record(start > task.submitted ? start - task.submitted : 0);
+            {
+                TRACE_SPAN("task", "threadpool");
+                task.task();
+            }
+            long long duration = getTime() - start;
+            self.runTime.record(duration);
+            Worker::increment(self.busyTime, duration);
+        } else {
+            TRACE_SPAN("task", "threadpool");
+            task.task();
+        }
+        Worker::increment(self.tasks);
+        // Release captured state before waiting for the next task
+        task.reset();
+    }
+
+    // Nanoseconds of the steady clock
+    static long long getTime() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(_Clock::now().time_since_epoch()).count();
+    }
+
+    bool stealTask(Worker &self, _TaskType *&task) {
+        size_t count = workers_.size();
+        // xorshift, each worker has its own state
+        self.random ^= self.random << 13;
+        self.random ^= self.random >> 17;
+        self.random ^= self.random << 5;
+        size_t start = self.random % count;
+        for (size_t i = 0; i < count; ++i) {
+            Worker &victim = *workers_[(start + i) % count];
+            if (&victim != &self && victim.deque.steal(task)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool hasStealableTask() const {
+        for (const auto &worker : workers_) {
+            if (!worker->deque.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isStamping() const {
+        return options_.isTaskTiming() || priorityUsed_.load(std::memory_order_relaxed);
+    }
+
+    void submit(_TaskType &&task) {
+        if (isStamping()) {
+            task.submitted = getTime();
+        }
+        Worker *worker = currentWorker();
+        if (options_.isWorkStealing() && worker && worker->pool == this) {
+            worker->deque.push(worker->acquireNode(std::move(task)));
+        } else {
+            pushGlobal(std::move(task));
+        }
+        // Single load unless some worker is parked
+        eventCount_.notifyOne();
+    }
+
+    void submit(std::vector<_TaskType> &&tasks) {
+        if (isStamping()) {
+            long long now = getTime();
+            for (auto &task : tasks) {
+                task.submitted = now;
+            }
+        }
+        Worker *worker = currentWorker();
+        if (options_.isWorkStealing() && worker && worker->pool == this) {
+            for (auto &task : tasks) {
+                worker->deque.push(worker->acquireNode(std::move(task)));
+            }
+        } else {
+            pushGlobal(tasks);
+        }
+        // One wakeup for the whole batch, futex wakes no more than are parked
+        eventCount_.notifyMany(tasks.size());
+    }
+
+    void pushGlobal(_TaskType &&task) {
+        // Once something overflowed, keep submission order by queueing behind it
+        if (overflowSize_.load(std::memory_order_acquire) == 0 && queue_.tryPush(std::move(task))) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(overflowMutex_);
+        overflow_.push(std::move(task));
+        overflowSize_.fetch_add(1, std::memory_order_release);
+    }
+
+    // Bulk version: ring slots are reserved for a run of tasks at a time,
+    // whatever does not fit goes to the overflow queue under one lock
+    void pushGlobal(std::vector<_TaskType> &tasks) {
+        size_t pushed = 0;
+        if (overflowSize_.load(std::memory_order_acquire) == 0) {
+            while (pushed < tasks.size()) {
+                size_t count = queue_.tryPushBulk(tasks.begin() + pushed, tasks.size() - pushed);
+                if (count == 0) {
+                    break;
+                }
+                pushed += count;
+            }
+        }
+        if (pushed == tasks.size()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(overflowMutex_);
+        for (size_t i = pushed; i < tasks.size(); ++i) {
+            overflow_.push(std::move(tasks[i]));
+        }
+        overflowSize_.fetch_add(tasks.size() - pushed, std::memory_order_release);
+    }
+
+    bool popGlobal(_TaskType &out) {
+        if (queue_.tryPop(out)) {
+            if (overflowSize_.load(std::memory_order_acquire) != 0) {
+                refillFromOverflow();
+            }
+            return true;
+        }
+        if (overflowSize_.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(overflowMutex_);
+        if (overflow_.empty()) {
+            return false;
+        }
+        out = std::move(overflow_.front());
+        overflow_.pop();
+        overflowSize_.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves overflowed tasks into slots freed by consumers
+    void refillFromOverflow() {
+        std::unique_lock<std::mutex> lock(overflowMutex_);
+        while (!overflow_.empty() && queue_.tryPush(std::move(overflow_.front()))) {
+            overflow_.pop();
+            overflowSize_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void submitPriority(int priority, _TaskType &&task) {
+        if (!priorityUsed_.load(std::memory_order_relaxed)) {
+            priorityUsed_.store(true, std::memory_order_relaxed);
+        }
+        task.submitted = getTime();
+        long long deadline = task.submitted - priority *
+            std::chrono::duration_cast<std::chrono::nanoseconds>(options_.getAgingQuantum()).count();
+        {
+            std::unique_lock<std::mutex> lock(priorityMutex_);
+            size_t slot;
+            if (freePrioritySlots_.empty()) {
+                slot = prioritySlots_.size();
+                prioritySlots_.push_back(std::move(task));
+            } else {
+                slot = freePrioritySlots_.back();
+                freePrioritySlots_.pop_back();
+                prioritySlots_[slot] = std::move(task);
+            }
+            priorityQueue_.insertHandle(slot, _PriorityKey(deadline, prioritySequence_++));
+            prioritySize_.fetch_add(1, std::memory_order_release);
+        }
+        eventCount_.notifyOne();
+    }
+
+    // Takes the top only if its virtual deadline is earlier than before,
+    // the submission time of the plain task it competes with
+    bool popPriority(_TaskType &out, long long before) {
+        if (prioritySize_.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(priorityMutex_);
+        if (priorityQueue_.empty() || priorityQueue_.getTop().getPriority().first >= before) {
+            return false;
+        }
+        size_t slot = priorityQueue_.getTop().getKey();
+        priorityQueue_.extractTop();
+        prioritySize_.fetch_sub(1, std::memory_order_release);
+        out = std::move(prioritySlots_[slot]);
+        freePrioritySlots_.push_back(slot);
+        return true;
+    }
+
+    TimerId addTimer(long long delay, long long interval, Task &&task) {
+        long long deadline = getTime() + delay;
+        TimerId id;
+        bool earliest;
+        {
+            std::unique_lock<std::mutex> lock(timerMutex_);
+            id = ++nextTimerId_;
+            Timer &timer = timers_[id];
+            timer.task = std::make_shared<Task>(std::move(task));
+            timer.interval = interval;
+            earliest = scheduleTimer(id, timer, deadline);
+        }
+        if (earliest) {
+            // The keeper sleeps until a later deadline, or there is no keeper
+            eventCount_.notifyAll();
+        }
+        return id;
+    }
+
+    // Called with timerMutex_ held. True if the timer became the earliest one
+    bool scheduleTimer(TimerId id, Timer &timer, long long deadline) {
+        timer.deadline = deadline;
+        timer.node = timerQueue_.insertHandle(id, _PriorityKey(deadline, timerSequence_++));
+        if (deadline < nextTimerDeadline_.load(std::memory_order_relaxed)) {
+            nextTimerDeadline_.store(deadline, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    bool isTimerDue() const {
+        long long deadline = nextTimerDeadline_.load(std::memory_order_relaxed);
+        return deadline != NoTimer && deadline <= getTime();
+    }
+
+    void updateNextTimerDeadline() {
+        nextTimerDeadline_.store(timerQueue_.empty() ? NoTimer : timerQueue_.getTop().getPriority().first,
+                                 std::memory_order_release);
+    }
+
+    void rescheduleTimer(TimerId id) {
+        long long now = getTime();
+        bool earliest;
+        {
+            std::unique_lock<std::mutex> lock(timerMutex_);
+            auto it = timers_.find(id);
+            if (it == timers_.end()) {
+                // Cancelled while running
+                return;
+            }
+            Timer &timer = it->second;
+            earliest = scheduleTimer(id, timer, std::max(timer.deadline + timer.interval, now));
+        }
+        if (earliest) {
+            eventCount_.notifyAll();
+        }
+    }
+
+    // Moves tasks of expired timers to the global queue
+    void fireDueTimers() {
+        long long now = getTime();
+        if (now < nextTimerDeadline_.load(std::memory_order_acquire) ||
+                closingFlag_.load(std::memory_order_acquire)) {
+            return;
+        }
+        size_t fired = 0;
+        {
+            std::unique_lock<std::mutex> lock(timerMutex_);
+            while (!timerQueue_.empty() && timerQueue_.getTop().getPriority().first <= now) {
+                TimerId id = timerQueue_.getTop().getKey();
+                timerQueue_.extractTop();
+                auto it = timers_.find(id);
+                Timer &timer = it->second;
+                timer.node = PriorityQueueHandle();
+                _TaskType task;
+                if (timer.interval == 0) {
+                    task = _TaskType(std::move(*timer.task));
+                    timers_.erase(it);
+                } else {
+                    PeriodicRun run = {this, id, timer.task};
+                    task = _TaskType(std::move(run));
+                }
+                task.submitted = isStamping() ? now : 0;
+                pushGlobal(std::move(task));
+                ++fired;
+            }
+            updateNextTimerDeadline();
+        }
+        // The caller takes one of them itself
+        for (size_t i = 1; i < fired; ++i) {
+            eventCount_.notifyOne();
+        }
+    }
+
+    ThreadPoolOptions options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    MpmcQueue<_TaskType> queue_;
+    std::queue<_TaskType> overflow_;
+    std::mutex overflowMutex_;
+    std::atomic<size_t> overflowSize_;
+    _PriorityQueue priorityQueue_;
+    std::vector<_TaskType> prioritySlots_;
+    std::vector<size_t> freePrioritySlots_;
+    std::mutex priorityMutex_;
+    std::atomic<size_t> prioritySize_;
+    unsigned long long prioritySequence_;
+    // Plain tasks are stamped for aging once set, never reset
+    std::atomic<bool> priorityUsed_;
+    EventCount eventCount_;
+    size_t minThreadCount_;
+    std::atomic<size_t> activeCount_;
+    std::atomic<size_t> blockedCount_;
+    std::atomic<bool> probePending_;
+    _TimerQueue timerQueue_;
+    std::unordered_map<TimerId, Timer> timers_;
+    std::mutex timerMutex_;
+    TimerId nextTimerId_;
+    unsigned long long timerSequence_;
+    // Earliest timer deadline, lets workers skip the timer lock
+    std::atomic<long long> nextTimerDeadline_;
+    // Some parked worker waits for nextTimerDeadline_
+    std::atomic<bool> timerKeeper_;
+    std::thread supervisor_;
+    std::mutex supervisorMutex_;
+    std::condition_variable supervisorCondition_;
+    std::atomic<bool> closingFlag_;
+};
+
+// Marks a section of a pool task that blocks on I/O or locks. An elastic
+// pool starts a replacement worker while the section lasts, so the other
+// tasks keep their share of threads. Outside of the pool's workers it has
+// no effect
+class BlockingScope {
+public:
+    BlockingScope(ThreadPool &pool):
+        pool_(pool.isWorkerThread() ? &pool : nullptr)
+    {
+        if (pool_) {
+            pool_->beginBlocking();
+        }
+    }
+
+    BlockingScope(const BlockingScope &rhs) = delete;
+    BlockingScope &operator= (const BlockingScope &rhs) = delete;
+
+    ~BlockingScope() {
+        if (pool_) {
+            pool_->endBlocking();
+        }
+    }
+
+private:
+    ThreadPool *pool_;
 };
 
+// Writes metrics of the pool to out every period from its own thread
+class MetricsReporter {
+public:
+    MetricsReporter(const ThreadPool &pool, std::ostream &out, std::chrono::milliseconds period):
+        pool_(pool),
+        out_(out),
+        period_(period),
+        stopped_(false)
+    {
+        if (period.count() <= 0) {
+            throw std::invalid_argument("Period must be positive (MetricsReporter::MetricsReporter)");
+        }
+        thread_ = std::thread(std::bind(&MetricsReporter::threadProc, this));
+    }
+
+    MetricsReporter(const MetricsReporter &rhs) = delete;
+    MetricsReporter &operator= (const MetricsReporter &rhs) = delete;
+
+    ~MetricsReporter() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopped_ = true;
+            condition_.notify_all();
+        }
+        thread_.join();
+    }
+
+private:
+    void threadProc() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!condition_.wait_for(lock, period_, [this] { return stopped_; })) {
+            pool_.getMetrics().print(out_);
+            out_.flush();
+        }
+    }
+
+    const ThreadPool &pool_;
+    std::ostream &out_;
+    std::chrono::milliseconds period_;
+    bool stopped_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::thread thread_;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+// Move-only type-erased void() callable. Callables up to InlineSize bytes
+// with noexcept move are stored inside the object, so constructing, queueing
+// and running a typical task does not touch the heap. Larger ones are
+// allocated once and only the pointer is moved afterwards.
+class Task {
+public:
+    static const size_t InlineSize = 6 * sizeof(void *);
+
+    Task(): ops_(nullptr) { }
+
+    template <class Fn, class = typename std::enable_if<
+        !std::is_same<typename std::decay<Fn>::type, Task>::value>::type>
+    Task(Fn &&fn): ops_(nullptr) {
+        typedef typename std::decay<Fn>::type Callable;
+        construct<Callable>(std::forward<Fn>(fn), IsInline<Callable>());
+    }
+
+    Task(const Task &rhs) = delete;
+    Task &operator= (const Task &rhs) = delete;
+
+    Task(Task &&rhs) noexcept: ops_(rhs.ops_) {
+        if (ops_) {
+            ops_->move(&storage_, &rhs.storage_);
+            rhs.ops_ = nullptr;
+        }
+    }
+
+    Task &operator= (Task &&rhs) noexcept {
+        if (this != &rhs) {
+            reset();
+            if (rhs.ops_) {
+                rhs.ops_->move(&storage_, &rhs.storage_);
+                ops_ = rhs.ops_;
+                rhs.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    // True if the callable lives in the inline buffer
+    bool isInline() const { return ops_ && ops_->isInline; }
+
+    void operator()() {
+        if (!ops_) {
+            throw std::logic_error("Empty task (Task::operator())");
+        }
+        ops_->invoke(&storage_);
+    }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    typedef typename std::aligned_storage<InlineSize, alignof(std::max_align_t)>::type Storage;
+
+    struct Ops {
+        void (*invoke)(void *storage);
+        void (*move)(void *to, void *from);
+        void (*destroy)(void *storage);
+        bool isInline;
+    };
+
+    template <class Fn>
+    struct IsInline: std::integral_constant<bool,
+        sizeof(Fn) <= InlineSize && alignof(Fn) <= alignof(Storage) &&
+        std::is_nothrow_move_constructible<Fn>::value> { };
+
+    template <class Fn>
+    struct InlineOps {
+        static void invoke(void *storage) { (*static_cast<Fn *>(storage))(); }
+
+        static void move(void *to, void *from) {
+            new (to) Fn(std::move(*static_cast<Fn *>(from)));
+            static_cast<Fn *>(from)->~Fn();
+        }
+
+        static void destroy(void *storage) { static_cast<Fn *>(storage)->~Fn(); }
+
+        static const Ops ops;
+    };
+
+    template <class Fn>
+    struct HeapOps {
+        static Fn *&get(void *storage) { return *static_cast<Fn **>(storage); }
+
+        static void invoke(void *storage) { (*get(storage))(); }
+
+        static void move(void *to, void *from) {
+            *static_cast<Fn **>(to) = get(from);
+            get(from) = nullptr;
+        }
+
+        static void destroy(void *storage) { delete get(storage); }
+
+        static const Ops ops;
+    };
+
+    template <class Callable, class Fn>
+    void construct(Fn &&fn, std::true_type) {
+        new (&storage_) Callable(std::forward<Fn>(fn));
+        ops_ = &InlineOps<Callable>::ops;
+    }
+
+    template <class Callable, class Fn>
+    void construct(Fn &&fn, std::false_type) {
+        *reinterpret_cast<Callable **>(&storage_) = new Callable(std::forward<Fn>(fn));
+        ops_ = &HeapOps<Callable>::ops;
+    }
+
+    const Ops *ops_;
+    Storage storage_;
+};
+
+template <class Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = {
+    &Task::InlineOps<Fn>::invoke, &Task::InlineOps<Fn>::move, &Task::InlineOps<Fn>::destroy, true
+};
+
+template <class Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = {
+    &Task::HeapOps<Fn>::invoke, &Task::HeapOps<Fn>::move, &Task::HeapOps<Fn>::destroy, false
+};
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+
+#include "pool.hpp"
+
+// Continuations and dependency graphs: work is posted to the pool when its
+// inputs are ready, so no thread blocks waiting for a predecessor.
+
+// Completion state shared by a TaskHandle and the tasks producing it
+class TaskStateBase {
+public:
+    TaskStateBase(ThreadPool &pool):
+        pool_(pool),
+        ready_(false)
+    { }
+
+    TaskStateBase(const TaskStateBase &rhs) = delete;
+    TaskStateBase &operator= (const TaskStateBase &rhs) = delete;
+
+    ThreadPool &getPool() const { return pool_; }
+
+    bool isReady() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ready_;
+    }
+
+    std::exception_ptr getError() const { return error_; }
+
+    // Runs tasks of the pool while waiting when called from its worker
+    void wait() {
+        pool_.helpUntil([this] (std::chrono::microseconds timeout) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return condition_.wait_for(lock, timeout, [this] { return ready_; });
+        });
+    }
+
+    // Task is posted right away if the state is ready
+    void addContinuation(Task &&task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!ready_) {
+                continuations_.push_back(std::move(task));
+                return;
+            }
+        }
+        pool_.post(std::move(task));
+    }
+
+    void setError(std::exception_ptr error) {
+        error_ = error;
+        finish();
+    }
+
+protected:
+    // Value or error must be stored before
+    void finish() {
+        std::vector<Task> continuations;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_ = true;
+            continuations.swap(continuations_);
+            condition_.notify_all();
+        }
+        for (auto &task : continuations) {
+            pool_.post(std::move(task));
+        }
+    }
+
+private:
+    ThreadPool &pool_;
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    bool ready_;
+    std::exception_ptr error_;
+    std::vector<Task> continuations_;
+};
+
+template <class T>
+class TaskState: public TaskStateBase {
+public:
+    TaskState(ThreadPool &pool): TaskStateBase(pool) { }
+
+    template <class Fn, class... Args>
+    void run(Fn &fn, Args &&... args) {
+        try {
+            value_.reset(new T(fn(std::forward<Args>(args)...)));
+        } catch (...) {
+            setError(std::current_exception());
+            return;
+        }
+        finish();
+    }
+
+    const T &getValue() const { return *value_; }
+
+private:
+    std::unique_ptr<T> value_;
+};
+
+template <>
+class TaskState<void>: public TaskStateBase {
+public:
+    TaskState(ThreadPool &pool): TaskStateBase(pool) { }
+
+    template <class Fn, class... Args>
+    void run(Fn &fn, Args &&... args) {
+        try {
+            fn(std::forward<Args>(args)...);
+        } catch (...) {
+            setError(std::current_exception());
+            return;
+        }
+        finish();
+    }
+};
+
+template <class T> class TaskHandle;
+
+template <class T>
+struct TaskResultReference {
+    typedef const T &type;
+};
+
+template <>
+struct TaskResultReference<void> {
+    typedef void type;
+};
+
+template <class T, class Fn>
+struct ContinuationResult {
+    typedef typename std::result_of<Fn(const T &)>::type type;
+};
+
+template <class Fn>
+struct ContinuationResult<void, Fn> {
+    typedef typename std::result_of<Fn()>::type type;
+};
+
+// Runs fn with the value of prev, or passes the error of prev on
+template <class T, class U, class Fn>
+struct Continuation {
+    void operator()() {
+        if (prev->getError()) {
+            next->setError(prev->getError());
+        } else {
+            invoke(std::is_void<T>());
+        }
+    }
+
+    void invoke(std::true_type) { next->run(fn); }
+    void invoke(std::false_type) { next->run(fn, prev->getValue()); }
+
+    std::shared_ptr<TaskState<T>> prev;
+    std::shared_ptr<TaskState<U>> next;
+    Fn fn;
+};
+
+template <class T, class Fn>
+struct SpawnedTask {
+    void operator()() { state->run(fn); }
+
+    std::shared_ptr<TaskState<T>> state;
+    Fn fn;
+};
+
+// Result of spawn() or then(). Unlike std::future may be copied, waited for
+// from pool tasks and extended with continuations
+template <class T>
+class TaskHandle {
+public:
+    TaskHandle() { }
+
+    explicit TaskHandle(std::shared_ptr<TaskState<T>> state):
+        state_(state)
+    { }
+
+    bool isValid() const { return static_cast<bool>(state_); }
+    bool isReady() const { return getState().isReady(); }
+    void wait() const { getState().wait(); }
+
+    // Waits and returns the value or rethrows the error of the task
+    typename TaskResultReference<T>::type get() const {
+        wait();
+        if (state_->getError()) {
+            std::rethrow_exception(state_->getError());
+        }
+        return getValue(std::is_void<T>());
+    }
+
+    // fn(value) (fn() for void tasks) is posted to the pool when this task
+    // completes. If it failed, fn is skipped and the error goes on
+    template <class Fn>
+    TaskHandle<typename ContinuationResult<T, Fn>::type> then(Fn fn) const {
+        typedef typename ContinuationResult<T, Fn>::type U;
+        std::shared_ptr<TaskState<U>> next = std::make_shared<TaskState<U>>(getState().getPool());
+        Continuation<T, U, Fn> continuation = {state_, next, std::move(fn)};
+        state_->addContinuation(Task(std::move(continuation)));
+        return TaskHandle<U>(next);
+    }
+
+private:
+    TaskState<T> &getState() const {
+        if (!state_) {
+            throw std::runtime_error("Handle has no task (TaskHandle::getState)");
+        }
+        return *state_;
+    }
+
+    void getValue(std::true_type) const { }
+    typename TaskResultReference<T>::type getValue(std::false_type) const {
+        return state_->getValue();
+    }
+
+    std::shared_ptr<TaskState<T>> state_;
+};
+
+// Like ThreadPool::addTask, but the result can be continued with then()
+template <class Fn>
+TaskHandle<typename std::result_of<Fn()>::type> spawn(ThreadPool &pool, Fn fn) {
+    typedef typename std::result_of<Fn()>::type T;
+    std::shared_ptr<TaskState<T>> state = std::make_shared<TaskState<T>>(pool);
+    SpawnedTask<T, Fn> task = {state, std::move(fn)};
+    pool.post(std::move(task));
+    return TaskHandle<T>(state);
+}
+
+// Set of tasks with "runs after" edges. A node is posted when all its
+// predecessors finished; if a node throws, nodes depending on it (directly
+// or not) are skipped, independent ones still run. Every run works on its
+// own copy of the graph, so it may be run many times, even concurrently.
+class TaskGraph {
+public:
+    typedef size_t NodeId;
+
+    NodeId addNode(std::function<void()> fn) {
+        if (!fn) {
+            throw std::invalid_argument("Empty node function (TaskGraph::addNode)");
+        }
+        nodes_.push_back(Node());
+        nodes_.back().fn = std::move(fn);
+        return nodes_.size() - 1;
+    }
+
+    // to runs after from
+    void addEdge(NodeId from, NodeId to) {
+        if (from >= nodes_.size() || to >= nodes_.size() || from == to) {
+            throw std::invalid_argument("Invalid node id (TaskGraph::addEdge)");
+        }
+        nodes_[from].successors.push_back(to);
+        ++nodes_[to].predecessorCount;
+    }
+
+    size_t getNodeCount() const { return nodes_.size(); }
+
+    // Posts root nodes and returns at once. The future is ready after every
+    // node ran or was skipped and holds the first error
+    std::future<void> run(ThreadPool &pool) const {
+        if (hasCycle()) {
+            throw std::invalid_argument("Graph has a cycle (TaskGraph::run)");
+        }
+        std::shared_ptr<Execution> execution = std::make_shared<Execution>(*this, pool);
+        std::future<void> result = execution->done.get_future();
+        if (nodes_.empty()) {
+            execution->done.set_value();
+            return result;
+        }
+        for (NodeId id = 0; id < nodes_.size(); ++id) {
+            if (nodes_[id].predecessorCount == 0) {
+                schedule(execution, id);
+            }
+        }
+        return result;
+    }
+
+private:
+    struct Node {
+        Node(): predecessorCount(0) { }
+
+        std::function<void()> fn;
+        std::vector<NodeId> successors;
+        size_t predecessorCount;
+    };
+
+    // Per-run counters, shared by the node tasks
+    struct Execution {
+        Execution(const TaskGraph &graph, ThreadPool &threadPool):
+            pool(threadPool),
+            nodes(graph.nodes_),
+            waiting(graph.nodes_.size()),
+            skipped(graph.nodes_.size()),
+            remaining(graph.nodes_.size())
+        {
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                waiting[i].store(nodes[i].predecessorCount, std::memory_order_relaxed);
+                skipped[i].store(false, std::memory_order_relaxed);
+            }
+        }
+
+        ThreadPool &pool;
+        // Copy, so that the graph may be changed while it runs
+        std::vector<Node> nodes;
+        std::vector<std::atomic<size_t>> waiting;
+        std::vector<std::atomic<bool>> skipped;
+        std::atomic<size_t> remaining;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        std::promise<void> done;
+    };
+
+    static void schedule(std::shared_ptr<Execution> execution, NodeId id) {
+        ThreadPool &pool = execution->pool;
+        pool.post([execution, id] { runNode(execution, id); });
+    }
+
+    static void runNode(const std::shared_ptr<Execution> &execution, NodeId id) {
+        bool failed = execution->skipped[id].load(std::memory_order_acquire);
+        if (!failed) {
+            try {
+                execution->nodes[id].fn();
+            } catch (...) {
+                failed = true;
+                std::lock_guard<std::mutex> lock(execution->errorMutex);
+                if (!execution->error) {
+                    execution->error = std::current_exception();
+                }
+            }
+        }
+        for (NodeId next : execution->nodes[id].successors) {
+            if (failed) {
+                execution->skipped[next].store(true, std::memory_order_release);
+            }
+            if (execution->waiting[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                schedule(execution, next);
+            }
+        }
+        if (execution->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if (execution->error) {
+                execution->done.set_exception(execution->error);
+            } else {
+                execution->done.set_value();
+            }
+        }
+    }
+
+    // Kahn's algorithm: a cycle leaves nodes that never become ready
+    bool hasCycle() const {
+        std::vector<size_t> waiting(nodes_.size());
+        std::vector<NodeId> ready;
+        for (NodeId id = 0; id < nodes_.size(); ++id) {
+            waiting[id] = nodes_[id].predecessorCount;
+            if (waiting[id] == 0) {
+                ready.push_back(id);
+            }
+        }
+        size_t visited = 0;
+        while (!ready.empty()) {
+            NodeId id = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (NodeId next : nodes_[id].successors) {
+                if (--waiting[next] == 0) {
+                    ready.push_back(next);
+                }
+            }
+        }
+        return visited != nodes_.size();
+    }
+
+    std::vector<Node> nodes_;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <exception>
+#include <condition_variable>
+
+#include "pool.hpp"
+
+// Structured fan-out: tasks are run in a group, the group waits for all of
+// them and stops them together.
+
+// Cancellation flag of a TaskGroup seen by its running tasks. Copies share
+// the flag, a default constructed token is never stopped
+class StopToken {
+public:
+    StopToken() { }
+
+    explicit StopToken(std::shared_ptr<const std::atomic<bool>> flag):
+        flag_(flag)
+    { }
+
+    bool isStopRequested() const {
+        return flag_ && flag_->load(std::memory_order_acquire);
+    }
+
+private:
+    std::shared_ptr<const std::atomic<bool>> flag_;
+};
+
+// Tasks posted to a pool as one unit. The first exception thrown by a task
+// cancels the group and is rethrown by wait(). Cancelling is cooperative:
+// tasks not started yet are dropped without running (they still pass
+// through the pool's queue, as a no-op), running ones should poll the stop
+// token. Tasks may run more tasks in the group. The destructor cancels and
+// waits, so that no task outlives the group
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool &pool):
+        state_(std::make_shared<State>(pool))
+    { }
+
+    TaskGroup(const TaskGroup &rhs) = delete;
+    TaskGroup &operator= (const TaskGroup &rhs) = delete;
+
+    ~TaskGroup() {
+        cancel();
+        waitAll();
+    }
+
+    // Task must be callable as fn(). Ignored once the group is cancelled
+    template <class Fn>
+    void run(Fn task) {
+        if (isCancelled()) {
+            return;
+        }
+        state_->pending.fetch_add(1, std::memory_order_relaxed);
+        GroupTask<Fn> groupTask = {state_, std::move(task)};
+        state_->pool.post(std::move(groupTask));
+    }
+
+    // Waits for every task run so far and rethrows the first error. Called
+    // from a worker, runs other tasks of the pool meanwhile
+    void wait() {
+        waitAll();
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->error) {
+            std::rethrow_exception(state_->error);
+        }
+    }
+
+    void cancel() {
+        state_->stopped.store(true, std::memory_order_release);
+    }
+
+    bool isCancelled() const {
+        return state_->stopped.load(std::memory_order_acquire);
+    }
+
+    StopToken getStopToken() const {
+        return StopToken(std::shared_ptr<const std::atomic<bool>>(state_, &state_->stopped));
+    }
+
+private:
+    // Shared with the tasks, so the last one may still notify while the
+    // group is being destroyed
+    struct State {
+        State(ThreadPool &threadPool):
+            pool(threadPool),
+            stopped(false),
+            pending(0)
+        { }
+
+        ThreadPool &pool;
+        std::atomic<bool> stopped;
+        std::atomic<size_t> pending;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::exception_ptr error;
+    };
+
+    template <class Fn>
+    struct GroupTask {
+        void operator()() {
+            if (!state->stopped.load(std::memory_order_acquire)) {
+                try {
+                    fn();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->error) {
+                        state->error = std::current_exception();
+                    }
+                    state->stopped.store(true, std::memory_order_release);
+                }
+            }
+            if (state->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->condition.notify_all();
+            }
+        }
+
+        std::shared_ptr<State> state;
+        Fn fn;
+    };
+
+    void waitAll() {
+        State &state = *state_;
+        state.pool.helpUntil([&state] (std::chrono::microseconds timeout) {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            return state.condition.wait_for(lock, timeout, [&state] {
+                return state.pending.load(std::memory_order_acquire) == 0;
+            });
+        });
+    }
+
+    std::shared_ptr<State> state_;
+};
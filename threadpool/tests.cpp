@@ -1,7 +1,16 @@
 #include <vector>
 #include <thread>
+#include <sstream>
+#include <array>
+#include <random>
+#include <numeric>
+#include <stdexcept>
 
 #include "pool.hpp"
+#include "parallel.hpp"
+#include "task_graph.hpp"
+#include "task_group.hpp"
+#include "executor.hpp"
 #define BOOST_TEST_MODULE ThreadPoolTest
 #include <boost/test/included/unit_test.hpp>
 
@@ -49,6 +58,7 @@ BOOST_AUTO_TEST_CASE(NonVoidFunctionTest) {
     std::future<int> sum = pool.addTask([&results]() -> int {
         int sum = 0;
         for (auto &x : results) {
+            pool.wait(x);
             sum += x.get();
         }
         return sum;
@@ -70,3 +80,821 @@ BOOST_AUTO_TEST_CASE(FunctionWithArgsTest) {
     BOOST_CHECK_EQUAL(sum, 2500);
 }
 
+
+BOOST_AUTO_TEST_CASE(TraceExportTest) {
+    Tracer::enable();
+    FutureVector<void> results;
+    for (int i = 0; i < 10; ++i) {
+        results.push_back(pool.addTask([] {
+            TraceSpan span("work", "test", "value", 42);
+        }));
+    }
+    ThreadPool::waitAll(results);
+    Tracer::disable();
+    std::stringstream out;
+    Tracer::dump(out);
+    std::string trace = out.str();
+    BOOST_CHECK_EQUAL(trace.find("{\"traceEvents\":["), 0);
+    size_t spans = 0;
+    for (size_t pos = trace.find("\"name\":\"work\""); pos != std::string::npos; 
+            pos = trace.find("\"name\":\"work\"", pos + 1)) {
+        ++spans;
+    }
+    BOOST_CHECK_EQUAL(spans, 10);
+    BOOST_CHECK(trace.find("\"args\":{\"value\":42}") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(TraceSpanArgumentsAreLazyTest) {
+    int evaluated = 0;
+    auto argument = [&evaluated] () -> long long {
+        ++evaluated;
+        return 7;
+    };
+    {
+        TRACE_SPAN("lazy", "test", "value", argument());
+    }
+    BOOST_CHECK_EQUAL(evaluated, 0);
+    Tracer::enable();
+    {
+        TRACE_SPAN("lazy", "test", "value", argument());
+    }
+    Tracer::disable();
+    BOOST_CHECK_EQUAL(evaluated, 1);
+    std::stringstream out;
+    Tracer::dump(out);
+    BOOST_CHECK(out.str().find("\"name\":\"lazy\"") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(TraceClearTest) {
+    Tracer::enable();
+    {
+        TraceSpan span("main", "test");
+    }
+    // Threads that exit one after another share a buffer
+    for (int i = 0; i < 20; ++i) {
+        std::thread([] {
+            TraceSpan span("exited", "test");
+        }).join();
+    }
+    BOOST_CHECK(Tracer::getBufferCount() <= pool.getThreadCount() + 2);
+    std::stringstream before;
+    Tracer::dump(before);
+    BOOST_CHECK(before.str().find("\"name\":\"exited\"") != std::string::npos);
+
+    Tracer::clear();
+    std::stringstream cleared;
+    Tracer::dump(cleared);
+    BOOST_CHECK(cleared.str().find("\"name\"") == std::string::npos);
+    {
+        TraceSpan span("after", "test");
+    }
+    Tracer::disable();
+    std::stringstream after;
+    Tracer::dump(after);
+    BOOST_CHECK(after.str().find("\"name\":\"after\"") != std::string::npos);
+    BOOST_CHECK(after.str().find("\"name\":\"main\"") == std::string::npos);
+    Tracer::clear();
+}
+
+BOOST_AUTO_TEST_CASE(PlacementPolicyTest) {
+    const NumaTopology &topology = NumaTopology::get();
+    BOOST_CHECK(topology.getNodeCount() >= 1);
+    BOOST_CHECK(topology.getCpuCount() >= 1);
+    BOOST_CHECK_EQUAL(topology.getCpuForThread(0, PlacementPolicy::None), -1);
+
+    ThreadPoolOptions options;
+    options.setPlacementPolicy(PlacementPolicy::Scatter);
+    ThreadPool pinned(2, options);
+    FutureVector<int> cpus;
+    for (size_t i = 0; i < 10; ++i) {
+        cpus.push_back(pinned.addTask([] {
+            return sched_getcpu();
+        }));
+    }
+    for (auto &cpu : cpus) {
+        int value = cpu.get();
+        BOOST_CHECK(value == topology.getCpuForThread(0, PlacementPolicy::Scatter) ||
+                    value == topology.getCpuForThread(1, PlacementPolicy::Scatter));
+    }
+}
+
+void spawnTree(ThreadPool &pool, int depth, std::atomic<int> &counter, int total, 
+               std::promise<void> &done) {
+    if (depth > 0) {
+        pool.addTask(std::bind(&spawnTree, std::ref(pool), depth - 1, std::ref(counter), 
+                    total, std::ref(done)));
+        pool.addTask(std::bind(&spawnTree, std::ref(pool), depth - 1, std::ref(counter), 
+                    total, std::ref(done)));
+    }
+    if (++counter == total) {
+        done.set_value();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(WorkStealingTest) {
+    ThreadPoolOptions options;
+    options.setWorkStealing(true);
+    ThreadPool stealingPool(4, options);
+    const int depth = 14;
+    const int total = (1 << (depth + 1)) - 1;
+    std::atomic<int> counter(0);
+    std::promise<void> done;
+    stealingPool.addTask(std::bind(&spawnTree, std::ref(stealingPool), depth, std::ref(counter), 
+                total, std::ref(done)));
+    done.get_future().wait();
+    BOOST_CHECK_EQUAL(counter.load(), total);
+
+    FutureVector<int> results;
+    for (int i = 1; i <= 100; ++i) {
+        results.push_back(stealingPool.addTask([i]() -> int {
+            return i * 5;
+        }));
+    }
+    int sum = 0;
+    for (auto &x : results) {
+        sum += x.get();
+    }
+    BOOST_CHECK_EQUAL(sum, 25250);
+}
+
+BOOST_AUTO_TEST_CASE(MpmcQueueTest) {
+    MpmcQueue<int> queue(8);
+    BOOST_CHECK_THROW(MpmcQueue<int>(6), std::invalid_argument);
+    for (int i = 0; i < 8; ++i) {
+        BOOST_CHECK(queue.tryPush(int(i)));
+    }
+    BOOST_CHECK(!queue.tryPush(8));
+    int value;
+    for (int i = 0; i < 8; ++i) {
+        BOOST_CHECK(queue.tryPop(value));
+        BOOST_CHECK_EQUAL(value, i);
+    }
+    BOOST_CHECK(!queue.tryPop(value));
+
+    // Bulk push takes what fits and keeps the order
+    std::vector<int> items(10);
+    for (int i = 0; i < 10; ++i) {
+        items[i] = i;
+    }
+    BOOST_CHECK(queue.tryPush(-1));
+    BOOST_CHECK_EQUAL(queue.tryPushBulk(items.begin(), items.size()), 7);
+    BOOST_CHECK_EQUAL(queue.tryPushBulk(items.begin() + 7, 3), 0);
+    for (int i = -1; i < 7; ++i) {
+        BOOST_CHECK(queue.tryPop(value));
+        BOOST_CHECK_EQUAL(value, i);
+    }
+    BOOST_CHECK(!queue.tryPop(value));
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentSubmissionTest) {
+    // Small ring so that producers regularly hit the overflow queue
+    ThreadPoolOptions options;
+    options.setQueueCapacity(16);
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        options.setWorkStealing(stealing != 0);
+        ThreadPool submitPool(3, options);
+        std::atomic<int> counter(0);
+        std::vector<std::thread> producers;
+        std::vector<FutureVector<void>> results(4);
+        for (size_t p = 0; p < results.size(); ++p) {
+            producers.emplace_back([&submitPool, &counter, &results, p] {
+                for (int i = 0; i < 5000; ++i) {
+                    results[p].push_back(submitPool.addTask([&counter] {
+                        ++counter;
+                    }));
+                }
+            });
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+        for (auto &fv : results) {
+            ThreadPool::waitAll(fv);
+        }
+        BOOST_CHECK_EQUAL(counter.load(), 20000);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MoveOnlyTaskTest) {
+    std::unique_ptr<int> value(new int(7));
+    Task small([] { });
+    BOOST_CHECK(small.isInline());
+    std::array<int, 64> big = {{0}};
+    Task large([big] { });
+    BOOST_CHECK(large && !large.isInline());
+    Task moved(std::move(large));
+    BOOST_CHECK(moved && !large);
+
+    std::future<int> result = pool.addTask(std::bind([] (std::unique_ptr<int> &p) {
+        return *p * 6;
+    }, std::move(value)));
+    BOOST_CHECK_EQUAL(result.get(), 42);
+
+    std::promise<int> promise;
+    std::unique_ptr<int> posted(new int(5));
+    pool.post(std::bind([&promise] (std::unique_ptr<int> &p) {
+        promise.set_value(*p);
+    }, std::move(posted)));
+    BOOST_CHECK_EQUAL(promise.get_future().get(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(FutureStatePoolTest) {
+    void *block = FutureStatePool::allocate(64);
+    FutureStatePool::deallocate(block, 64);
+    BOOST_CHECK_EQUAL(FutureStatePool::allocate(32), block);
+    FutureStatePool::deallocate(block, 32);
+
+    // A thread that only frees blocks returns them to the depot on exit
+    std::vector<void *> blocks;
+    for (int i = 0; i < 64; ++i) {
+        blocks.push_back(FutureStatePool::allocate(64));
+    }
+    size_t depotSize = FutureStatePool::getDepotSize();
+    std::thread([&blocks] {
+        for (void *p : blocks) {
+            FutureStatePool::deallocate(p, 64);
+        }
+    }).join();
+    BOOST_CHECK_EQUAL(FutureStatePool::getDepotSize(), depotSize + blocks.size());
+
+    std::future<void> failed = pool.addTask([] { throw std::runtime_error("failed"); });
+    BOOST_CHECK_THROW(failed.get(), std::runtime_error);
+    int value = 0;
+    std::future<int &> ref = pool.addTask(1, [&value] () -> int & { return value; });
+    BOOST_CHECK_EQUAL(&ref.get(), &value);
+
+    std::vector<std::function<int()>> fns;
+    for (int i = 0; i < 1000; ++i) {
+        fns.push_back([i] { return i; });
+    }
+    FutureVector<int> results = pool.addTasks(fns.begin(), fns.end());
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_CHECK_EQUAL(results[i].get(), i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PriorityTest) {
+    ThreadPoolOptions options;
+    options.setAgingQuantum(std::chrono::seconds(10));
+    ThreadPool single(1, options);
+    std::vector<int> order;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    single.addTask([released] { released.wait(); });
+    FutureVector<void> results;
+    results.push_back(single.addTask(TaskPriority::Low, [&order] { order.push_back(-1); }));
+    results.push_back(single.addTask([&order] { order.push_back(0); }));
+    results.push_back(single.addTask(TaskPriority::High, [&order] { order.push_back(1); }));
+    results.push_back(single.addTask(5, [&order] { order.push_back(5); }));
+    release.set_value();
+    ThreadPool::waitAll(results);
+    BOOST_CHECK(order == std::vector<int>({5, 1, 0, -1}));
+
+    // Low priority task overtakes high priority ones submitted much later
+    options.setAgingQuantum(std::chrono::milliseconds(1));
+    ThreadPool aging(1, options);
+    order.clear();
+    results.clear();
+    std::promise<void> agingRelease;
+    released = agingRelease.get_future().share();
+    aging.addTask([released] { released.wait(); });
+    results.push_back(aging.addTask(TaskPriority::Low, [&order] { order.push_back(-1); }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    results.push_back(aging.addTask(TaskPriority::High, [&order] { order.push_back(1); }));
+    agingRelease.set_value();
+    ThreadPool::waitAll(results);
+    BOOST_CHECK(order == std::vector<int>({-1, 1}));
+}
+
+BOOST_AUTO_TEST_CASE(PriorityStarvationTest) {
+    ThreadPoolOptions options;
+    options.setAgingQuantum(std::chrono::milliseconds(1));
+    ThreadPool single(1, options);
+    // Keeps high priority tasks queued all the time
+    std::atomic<bool> stop(false);
+    std::atomic<int> pending(0);
+    std::thread producer([&] {
+        while (!stop.load()) {
+            if (pending.load() >= 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            ++pending;
+            single.addTask(TaskPriority::High, [&pending] {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                --pending;
+            });
+        }
+    });
+    while (pending.load() < 64) {
+        std::this_thread::yield();
+    }
+    std::future<int> plain = single.addTask([] { return 1; });
+    std::future<int> normal = single.addTask(TaskPriority::Normal, [] { return 2; });
+    bool plainDone = plain.wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+    bool normalDone = normal.wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+    stop = true;
+    producer.join();
+    BOOST_CHECK(plainDone && normalDone);
+}
+
+BOOST_AUTO_TEST_CASE(PriorityWaitsOnPlainTest) {
+    ThreadPoolOptions options;
+    options.setAgingQuantum(std::chrono::seconds(10));
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        options.setWorkStealing(stealing != 0);
+        ThreadPool twoWorkers(2, options);
+        std::promise<void> release;
+        std::shared_future<void> released = release.get_future().share();
+        FutureVector<void> blockers;
+        for (int i = 0; i < 2; ++i) {
+            blockers.push_back(twoWorkers.addTask([released] { released.wait(); }));
+        }
+        // The worker that takes the plain task runs the priority one first,
+        // the other worker must still see the plain task
+        std::promise<void> plainDone;
+        std::shared_future<void> plain = plainDone.get_future().share();
+        std::future<bool> waiting = twoWorkers.addTask(TaskPriority::High, [plain] {
+            return plain.wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+        });
+        twoWorkers.post([&plainDone] { plainDone.set_value(); });
+        release.set_value();
+        BOOST_CHECK(waiting.get());
+        ThreadPool::waitAll(blockers);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ParallelAlgorithmsTest) {
+    ThreadPoolOptions options;
+    options.setWorkStealing(true);
+    ThreadPool stealingPool(4, options);
+    for (ThreadPool *p : {&pool, &stealingPool}) {
+        std::vector<int> visits(10000, 0);
+        parallelFor(*p, size_t(0), visits.size(), [&visits] (size_t i) {
+            ++visits[i];
+        }, 7);
+        BOOST_CHECK(std::count(visits.begin(), visits.end(), 1) == 10000);
+
+        long long sum = parallelReduce(*p, 0, 100000, 0LL, [] (int i) {
+            return static_cast<long long>(i);
+        }, std::plus<long long>());
+        BOOST_CHECK_EQUAL(sum, 4999950000LL);
+
+        std::vector<int> numbers(100000);
+        std::mt19937 random(42);
+        for (auto &x : numbers) {
+            x = random() % 1000;
+        }
+        std::vector<int> expected(numbers.size());
+        std::partial_sum(numbers.begin(), numbers.end(), expected.begin());
+        std::vector<int> scanned(numbers.size());
+        parallelScan(*p, numbers.begin(), numbers.end(), scanned.begin(), 0, std::plus<int>());
+        BOOST_CHECK(scanned == expected);
+
+        expected = numbers;
+        std::sort(expected.begin(), expected.end(), std::greater<int>());
+        parallelSort(*p, numbers.begin(), numbers.end(), std::greater<int>(), 100);
+        BOOST_CHECK(numbers == expected);
+
+        BOOST_CHECK_THROW(parallelFor(*p, 0, 1000, [] (int i) {
+            if (i == 500) {
+                throw std::runtime_error("failure");
+            }
+        }, 10), std::runtime_error);
+    }
+}
+
+int nestedSum(ThreadPool &pool, int depth) {
+    if (depth == 0) {
+        return 1;
+    }
+    std::future<int> left = pool.addTask(std::bind(&nestedSum, std::ref(pool), depth - 1));
+    std::future<int> right = pool.addTask(std::bind(&nestedSum, std::ref(pool), depth - 1));
+    pool.wait(left);
+    pool.wait(right);
+    return left.get() + right.get();
+}
+
+BOOST_AUTO_TEST_CASE(HelpWhileWaitingTest) {
+    // Every task waits for two others: a blocking wait would deadlock at
+    // depth 1 with one thread
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        ThreadPoolOptions options;
+        options.setWorkStealing(stealing != 0);
+        ThreadPool single(1, options);
+        std::future<int> result = single.addTask(std::bind(&nestedSum, std::ref(single), 10));
+        single.wait(result);
+        BOOST_CHECK_EQUAL(result.get(), 1024);
+
+        // Nested parallel algorithms on a single worker
+        std::future<long long> total = single.addTask([&single] {
+            return parallelReduce(single, 0, 100, 0LL, [&single] (int i) {
+                return parallelReduce(single, 0, 100, 0LL, [i] (int j) {
+                    return static_cast<long long>(i * j);
+                }, std::plus<long long>(), 10);
+            }, std::plus<long long>(), 10);
+        });
+        BOOST_CHECK_EQUAL(total.get(), 4950LL * 4950LL);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ContinuationTest) {
+    TaskHandle<int> value = spawn(pool, [] { return 20; });
+    TaskHandle<std::string> text = value.then([] (int x) {
+        return x + 1;
+    }).then([] (int x) {
+        return std::to_string(x * 2);
+    });
+    BOOST_CHECK_EQUAL(text.get(), "42");
+
+    std::atomic<int> calls(0);
+    TaskHandle<void> failed = spawn(pool, [] () -> int {
+        throw std::runtime_error("failure");
+    }).then([&calls] (int) {
+        ++calls;
+    });
+    BOOST_CHECK_THROW(failed.get(), std::runtime_error);
+    BOOST_CHECK_EQUAL(calls.load(), 0);
+
+    // Continuation added after completion is posted at once
+    value.wait();
+    BOOST_CHECK_EQUAL(value.then([] (int x) { return x * 3; }).get(), 60);
+}
+
+BOOST_AUTO_TEST_CASE(TaskGraphTest) {
+    // a -> b, a -> c, b -> d, c -> d
+    std::mutex orderMutex;
+    std::vector<char> order;
+    auto visit = [&orderMutex, &order] (char name) {
+        return [&orderMutex, &order, name] {
+            std::lock_guard<std::mutex> lock(orderMutex);
+            order.push_back(name);
+        };
+    };
+    TaskGraph graph;
+    TaskGraph::NodeId a = graph.addNode(visit('a'));
+    TaskGraph::NodeId b = graph.addNode(visit('b'));
+    TaskGraph::NodeId c = graph.addNode(visit('c'));
+    TaskGraph::NodeId d = graph.addNode(visit('d'));
+    graph.addEdge(a, b);
+    graph.addEdge(a, c);
+    graph.addEdge(b, d);
+    graph.addEdge(c, d);
+    for (int run = 0; run < 10; ++run) {
+        order.clear();
+        graph.run(pool).get();
+        BOOST_CHECK_EQUAL(order.size(), 4);
+        BOOST_CHECK_EQUAL(order.front(), 'a');
+        BOOST_CHECK_EQUAL(order.back(), 'd');
+    }
+
+    // Failure skips dependent nodes only
+    order.clear();
+    TaskGraph failing;
+    TaskGraph::NodeId bad = failing.addNode([] { throw std::runtime_error("failure"); });
+    failing.addEdge(bad, failing.addNode(visit('x')));
+    failing.addNode(visit('y'));
+    BOOST_CHECK_THROW(failing.run(pool).get(), std::runtime_error);
+    BOOST_CHECK(order == std::vector<char>(1, 'y'));
+
+    graph.addEdge(d, a);
+    BOOST_CHECK_THROW(graph.run(pool), std::invalid_argument);
+    BOOST_CHECK_THROW(graph.addEdge(a, 100), std::invalid_argument);
+}
+
+// Polls condition for up to two seconds
+template <class Predicate>
+bool eventually(Predicate condition) {
+    for (int i = 0; i < 2000; ++i) {
+        if (condition()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return condition();
+}
+
+BOOST_AUTO_TEST_CASE(ElasticPoolTest) {
+    ThreadPoolOptions options;
+    options.setMaxThreadCount(4);
+    options.setIdleTimeout(std::chrono::milliseconds(20));
+    options.setQueueLatencyThreshold(std::chrono::milliseconds(2));
+    for (int marked = 0; marked < 2; ++marked) {
+        ThreadPool elastic(1, options);
+        BOOST_CHECK(elastic.isElastic());
+        BOOST_CHECK_EQUAL(elastic.getThreadCount(), 1);
+        // Four tasks blocked at once need four threads, with or without
+        // BlockingScope (queue latency grows then)
+        std::atomic<int> started(0);
+        std::promise<void> release;
+        std::shared_future<void> released = release.get_future().share();
+        FutureVector<void> results;
+        for (int i = 0; i < 4; ++i) {
+            results.push_back(elastic.addTask([&elastic, &started, released, marked] {
+                ++started;
+                if (marked) {
+                    BlockingScope blocking(elastic);
+                    released.wait();
+                } else {
+                    released.wait();
+                }
+            }));
+        }
+        BOOST_CHECK(eventually([&started] { return started == 4; }));
+        BOOST_CHECK(elastic.getThreadCount() <= 4);
+        release.set_value();
+        ThreadPool::waitAll(results);
+        BOOST_CHECK(eventually([&elastic] { return elastic.getThreadCount() == 1; }));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MetricsTest) {
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 100000; ++value) {
+        histogram.record(value);
+    }
+    HistogramSnapshot snapshot(histogram);
+    BOOST_CHECK_EQUAL(snapshot.getCount(), 100000);
+    BOOST_CHECK_EQUAL(snapshot.getMax(), 100000);
+    BOOST_CHECK_CLOSE(snapshot.getMean(), 50000.5, 0.001);
+    BOOST_CHECK_CLOSE(static_cast<double>(snapshot.getPercentile(50)), 50000.0, 12.5);
+    BOOST_CHECK_CLOSE(static_cast<double>(snapshot.getPercentile(99)), 99000.0, 12.5);
+    BOOST_CHECK_EQUAL(snapshot.getPercentile(100), 100000);
+
+    ThreadPoolOptions options;
+    options.setTaskTiming(true);
+    options.setWorkStealing(true);
+    ThreadPool measured(2, options);
+    std::ostringstream report;
+    {
+        MetricsReporter reporter(measured, report, std::chrono::milliseconds(5));
+        FutureVector<void> results;
+        for (int i = 0; i < 100; ++i) {
+            results.push_back(measured.addTask([] {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }));
+        }
+        ThreadPool::waitAll(results);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ThreadPoolMetrics metrics = measured.getMetrics();
+    BOOST_CHECK_EQUAL(metrics.threadCount, 2);
+    BOOST_CHECK_EQUAL(metrics.tasks, 100);
+    BOOST_CHECK_EQUAL(metrics.runTime.getCount(), 100);
+    BOOST_CHECK(metrics.runTime.getPercentile(50) >= 200000);
+    BOOST_CHECK_EQUAL(metrics.waitTime.getCount(), 100);
+    BOOST_CHECK_EQUAL(metrics.workers.size(), 2);
+    BOOST_CHECK(report.str().find("tasks: 100") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(TimerTest) {
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        ThreadPoolOptions options;
+        options.setWorkStealing(stealing != 0);
+        ThreadPool timed(2, options);
+        // Workers are parked, the keeper has to wake up for the deadline
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::promise<std::chrono::steady_clock::time_point> fired;
+        std::future<std::chrono::steady_clock::time_point> firedTime = fired.get_future();
+        ThreadPool::TimerId delayed = timed.addDelayedTask(std::chrono::milliseconds(20), [&fired] {
+            fired.set_value(std::chrono::steady_clock::now());
+        });
+        BOOST_CHECK(firedTime.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+        BOOST_CHECK(firedTime.get() - start >= std::chrono::milliseconds(20));
+        BOOST_CHECK(!timed.cancelTimer(delayed));
+
+        std::atomic<int> cancelledRuns(0);
+        ThreadPool::TimerId cancelled = timed.addDelayedTask(std::chrono::milliseconds(10), [&cancelledRuns] {
+            ++cancelledRuns;
+        });
+        // A later timer added first must not hold back an earlier one
+        std::atomic<int> order(0);
+        std::atomic<int> lateOrder(0);
+        std::atomic<int> earlyOrder(0);
+        timed.addDelayedTask(std::chrono::milliseconds(30), [&order, &lateOrder] { lateOrder = ++order; });
+        timed.addDelayedTask(std::chrono::milliseconds(5), [&order, &earlyOrder] { earlyOrder = ++order; });
+        BOOST_CHECK(timed.cancelTimer(cancelled));
+
+        std::atomic<int> ticks(0);
+        ThreadPool::TimerId periodic = timed.addPeriodicTask(std::chrono::milliseconds(2), [&ticks] { ++ticks; });
+        BOOST_CHECK(eventually([&ticks] { return ticks >= 5; }));
+        BOOST_CHECK(timed.cancelTimer(periodic));
+        BOOST_CHECK(!timed.cancelTimer(periodic));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        int stopped = ticks;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        BOOST_CHECK_EQUAL(ticks, stopped);
+
+        BOOST_CHECK(eventually([&order] { return order == 2; }));
+        BOOST_CHECK_EQUAL(earlyOrder, 1);
+        BOOST_CHECK_EQUAL(lateOrder, 2);
+        BOOST_CHECK_EQUAL(cancelledRuns, 0);
+    }
+    BOOST_CHECK_THROW(pool.addPeriodicTask(std::chrono::microseconds(0), [] { }), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(SpinningIdleStrategyTest) {
+    ThreadPoolOptions options;
+    options.setSpinCount(1 << 16);
+    options.setYieldCount(1000);
+    options.setTaskTiming(true);
+    ThreadPool spinning(2, options);
+    // Ping-pong: each task is submitted right after the previous one finished,
+    // a spinning worker picks most of them up without parking
+    const int count = 1000;
+    for (int i = 0; i < count; ++i) {
+        BOOST_CHECK_EQUAL(spinning.addTask([i] { return i; }).get(), i);
+    }
+    // The counter is updated after the result is set
+    BOOST_CHECK(eventually([&spinning] { return spinning.getMetrics().tasks == count; }));
+    ThreadPoolMetrics metrics = spinning.getMetrics();
+    BOOST_CHECK(metrics.parks < count / 2);
+    // Budget runs out, idle workers still park
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    BOOST_CHECK(spinning.getMetrics().parks > metrics.parks);
+    std::atomic<int> delayed(0);
+    spinning.addDelayedTask(std::chrono::milliseconds(5), [&delayed] { ++delayed; });
+    BOOST_CHECK(eventually([&delayed] { return delayed == 1; }));
+}
+
+BOOST_AUTO_TEST_CASE(TaskGroupTest) {
+    {
+        TaskGroup group(pool);
+        std::atomic<int> sum(0);
+        for (int i = 1; i <= 100; ++i) {
+            group.run([&sum, i] { sum += i; });
+        }
+        group.wait();
+        BOOST_CHECK_EQUAL(sum, 5050);
+        BOOST_CHECK(!group.isCancelled());
+    }
+    {
+        // One worker runs the tasks in order: the failure drops the rest
+        ThreadPool single(1);
+        TaskGroup group(single);
+        std::atomic<int> ran(0);
+        group.run([] { throw std::runtime_error("failed"); });
+        for (int i = 0; i < 100; ++i) {
+            group.run([&ran] { ++ran; });
+        }
+        BOOST_CHECK_THROW(group.wait(), std::runtime_error);
+        BOOST_CHECK(group.isCancelled());
+        BOOST_CHECK_EQUAL(ran, 0);
+        // The group stays failed
+        group.run([&ran] { ++ran; });
+        BOOST_CHECK_THROW(group.wait(), std::runtime_error);
+        BOOST_CHECK_EQUAL(ran, 0);
+    }
+    {
+        // Running tasks stop when they see the token
+        TaskGroup group(pool);
+        StopToken token = group.getStopToken();
+        std::atomic<int> started(0);
+        for (int i = 0; i < 2; ++i) {
+            group.run([token, &started] {
+                ++started;
+                while (!token.isStopRequested()) {
+                    std::this_thread::yield();
+                }
+            });
+        }
+        BOOST_CHECK(eventually([&started] { return started == 2; }));
+        BOOST_CHECK(!token.isStopRequested());
+        group.cancel();
+        group.wait();
+        BOOST_CHECK(token.isStopRequested());
+        BOOST_CHECK(!StopToken().isStopRequested());
+    }
+    {
+        // Tasks fan out further and wait for a nested group
+        TaskGroup group(pool);
+        std::atomic<int> leaves(0);
+        for (int i = 0; i < 4; ++i) {
+            group.run([&group, &leaves] {
+                for (int j = 0; j < 4; ++j) {
+                    group.run([&leaves] { ++leaves; });
+                }
+                TaskGroup nested(pool);
+                for (int j = 0; j < 4; ++j) {
+                    nested.run([&leaves] { ++leaves; });
+                }
+                nested.wait();
+            });
+        }
+        group.wait();
+        BOOST_CHECK_EQUAL(leaves, 32);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ExecutorTest) {
+    DefaultExecutor::configure(2);
+    ThreadPool &executor = DefaultExecutor::get();
+    BOOST_CHECK_EQUAL(&executor, &DefaultExecutor::get());
+    BOOST_CHECK_EQUAL(executor.getThreadCount(), 2);
+    BOOST_CHECK(executor.getOptions().isWorkStealing());
+    BOOST_CHECK_THROW(DefaultExecutor::configure(4), std::logic_error);
+    BOOST_CHECK_THROW(TaskArena(executor, 0), std::invalid_argument);
+
+    {
+        // At most one of the arena's tasks runs at a time on a wider pool
+        TaskArena arena(pool, 1);
+        BOOST_CHECK_EQUAL(arena.getThreadCount(), 1);
+        std::atomic<int> running(0);
+        std::atomic<int> maxRunning(0);
+        std::atomic<int> done(0);
+        for (int i = 0; i < 20; ++i) {
+            arena.post([&running, &maxRunning, &done] {
+                int current = ++running;
+                int max = maxRunning;
+                while (current > max && !maxRunning.compare_exchange_weak(max, current)) { }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                --running;
+                ++done;
+            });
+        }
+        std::future<int> result = arena.addTask([] { return 42; });
+        arena.wait(result);
+        BOOST_CHECK_EQUAL(result.get(), 42);
+        arena.wait();
+        BOOST_CHECK_EQUAL(done, 20);
+        BOOST_CHECK_EQUAL(maxRunning, 1);
+    }
+    {
+        // Nested fork-join inside a one-task arena runs queued pieces inline
+        TaskArena arena(executor, 1);
+        std::vector<int> data(100000);
+        std::mt19937 random(7);
+        for (auto &item : data) {
+            item = static_cast<int>(random() % 1000);
+        }
+        std::vector<int> expected = data;
+        std::sort(expected.begin(), expected.end());
+        parallelSort(arena, data.begin(), data.end(), std::less<int>(), 2048);
+        BOOST_CHECK(data == expected);
+        std::atomic<int> sum(0);
+        parallelFor(arena, 0, 16, [&arena, &sum] (int) {
+            parallelFor(arena, 0, 16, [&sum] (int) { ++sum; }, 1);
+        }, 1);
+        BOOST_CHECK_EQUAL(sum, 256);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BatchSubmitTest) {
+    // Small ring so that batches spill into the overflow queue
+    ThreadPoolOptions options;
+    options.setQueueCapacity(16);
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        options.setWorkStealing(stealing != 0);
+        ThreadPool batchPool(3, options);
+        std::vector<std::function<int()>> tasks;
+        for (int i = 0; i < 1000; ++i) {
+            tasks.push_back([i] { return i; });
+        }
+        FutureVector<int> results = batchPool.addTasks(tasks.begin(), tasks.end());
+        BOOST_CHECK_EQUAL(results.size(), 1000);
+        for (int i = 0; i < 1000; ++i) {
+            BOOST_CHECK_EQUAL(results[i].get(), i);
+        }
+
+        // Batch submitted from a worker
+        std::atomic<int> counter(0);
+        std::future<void> outer = batchPool.addTask([&batchPool, &counter] {
+            std::vector<std::function<void()>> inner(100, [&counter] { ++counter; });
+            std::future<void> done = batchPool.addBatch(inner.begin(), inner.end());
+            batchPool.wait(done);
+            done.get();
+        });
+        outer.get();
+        BOOST_CHECK_EQUAL(counter, 100);
+    }
+
+    // Every task runs, the aggregate future holds the failure
+    std::vector<std::function<void()>> failing;
+    std::atomic<int> ran(0);
+    for (int i = 0; i < 50; ++i) {
+        failing.push_back([&ran, i] {
+            ++ran;
+            if (i % 10 == 3) {
+                throw std::runtime_error("failed");
+            }
+        });
+    }
+    std::future<void> failed = pool.addBatch(failing.begin(), failing.end());
+    BOOST_CHECK_THROW(failed.get(), std::runtime_error);
+    BOOST_CHECK_EQUAL(ran, 50);
+
+    // Move-only callables
+    std::vector<std::packaged_task<int()>> moveOnly;
+    for (int i = 0; i < 4; ++i) {
+        std::unique_ptr<int> value(new int(i));
+        moveOnly.push_back(std::packaged_task<int()>(std::bind([] (std::unique_ptr<int> &p) {
+            return *p;
+        }, std::move(value))));
+    }
+    FutureVector<void> moved = pool.addTasks(moveOnly.begin(), moveOnly.end());
+    ThreadPool::waitAll(moved);
+
+    std::vector<std::function<void()>> none;
+    BOOST_CHECK(pool.addTasks(none.begin(), none.end()).empty());
+    pool.addBatch(none.begin(), none.end()).get();
+}
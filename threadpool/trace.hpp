@@ -0,0 +1,356 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <fstream>
+#include <stdexcept>
+
+// Timeline of task execution in Chrome trace_event format (chrome://tracing,
+// Perfetto). Every thread writes spans into its own buffer, the only shared
+// state touched on the hot path is the enabled flag and the generation
+// counter of clear().
+
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    const char *argName;
+    long long argValue;
+    double begin;
+    double duration;
+};
+
+class TraceBuffer {
+private:
+    static const size_t ChunkSize = 4096;
+
+    struct Chunk {
+        Chunk(): size(0), next(nullptr) { }
+        TraceEvent events[ChunkSize];
+        std::atomic<size_t> size;
+        std::atomic<Chunk *> next;
+    };
+
+public:
+    TraceBuffer(unsigned tid, unsigned long long generation):
+        tid_(tid),
+        generation_(generation),
+        head_(new Chunk()),
+        tail_(head_)
+    { }
+
+    TraceBuffer(const TraceBuffer &rhs) = delete;
+    TraceBuffer &operator= (const TraceBuffer &rhs) = delete;
+
+    ~TraceBuffer() { deleteChunks(head_); }
+
+    unsigned getTid() const { return tid_; }
+
+    // Called only by the owning thread. Events of an older generation are
+    // dropped first (see Tracer::clear)
+    void append(const TraceEvent &event, unsigned long long generation) {
+        if (generation_.load(std::memory_order_relaxed) != generation) {
+            reset(generation);
+        }
+        size_t size = tail_->size.load(std::memory_order_relaxed);
+        if (size == ChunkSize) {
+            Chunk *chunk = new Chunk();
+            tail_->next.store(chunk, std::memory_order_release);
+            tail_ = chunk;
+            size = 0;
+        }
+        tail_->events[size] = event;
+        tail_->size.store(size + 1, std::memory_order_release);
+    }
+
+    // May be called concurrently with append, sees all published events of
+    // the given generation
+    template <class Fn>
+    void forEach(unsigned long long generation, Fn fn) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation_.load(std::memory_order_relaxed) != generation) {
+            return;
+        }
+        for (Chunk *chunk = head_; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            size_t size = chunk->size.load(std::memory_order_acquire);
+            for (size_t i = 0; i < size; ++i) {
+                fn(chunk->events[i]);
+            }
+        }
+    }
+
+private:
+    static void deleteChunks(Chunk *chunk) {
+        while (chunk) {
+            Chunk *next = chunk->next.load(std::memory_order_relaxed);
+            delete chunk;
+            chunk = next;
+        }
+    }
+
+    // Keeps the first chunk, waits for forEach running on this buffer
+    void reset(unsigned long long generation) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        deleteChunks(head_->next.load(std::memory_order_relaxed));
+        head_->next.store(nullptr, std::memory_order_relaxed);
+        head_->size.store(0, std::memory_order_relaxed);
+        tail_ = head_;
+        generation_.store(generation, std::memory_order_relaxed);
+    }
+
+    unsigned tid_;
+    std::mutex mutex_;
+    std::atomic<unsigned long long> generation_;
+    Chunk *head_;
+    Chunk *tail_;
+};
+
+class Tracer {
+public:
+    static void enable() { enabledFlag().store(true, std::memory_order_relaxed); }
+    static void disable() { enabledFlag().store(false, std::memory_order_relaxed); }
+
+    static bool isEnabled() {
+        return enabledFlag().load(std::memory_order_relaxed);
+    }
+
+    // Microseconds since the first use of the tracer
+    static double now() {
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - getState().epoch;
+        return elapsed.count();
+    }
+
+    static void record(const TraceEvent &event) {
+        TraceBuffer *buffer = localBuffer();
+        if (buffer) {
+            buffer->append(event, getState().generation.load(std::memory_order_acquire));
+        }
+    }
+
+    // Drops all recorded events, e.g. after dump. Threads free their chunks
+    // at their next event, buffers of exited threads are freed at once
+    static void clear() {
+        State &state = getState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.generation.fetch_add(1, std::memory_order_release);
+        for (TraceBuffer *buffer : state.retired) {
+            for (size_t i = 0; i < state.buffers.size(); ++i) {
+                if (state.buffers[i].get() == buffer) {
+                    state.buffers.erase(state.buffers.begin() + i);
+                    break;
+                }
+            }
+        }
+        state.retired.clear();
+    }
+
+    // Buffers kept by the tracer: one per thread recording at the moment,
+    // plus those left by exited threads since the last clear
+    static size_t getBufferCount() {
+        std::lock_guard<std::mutex> lock(getState().mutex);
+        return getState().buffers.size();
+    }
+
+    static void dump(std::ostream &out) {
+        std::vector<std::shared_ptr<TraceBuffer>> buffers;
+        unsigned long long generation;
+        {
+            std::lock_guard<std::mutex> lock(getState().mutex);
+            buffers = getState().buffers;
+            generation = getState().generation.load(std::memory_order_relaxed);
+        }
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto &buffer : buffers) {
+            unsigned tid = buffer->getTid();
+            buffer->forEach(generation, [&out, &first, tid] (const TraceEvent &event) {
+                out << (first ? "\n" : ",\n");
+                first = false;
+                writeEvent(out, event, tid);
+            });
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    static void dumpToFile(const std::string &fileName) {
+        std::ofstream file(fileName.c_str());
+        if (!file) {
+            throw std::runtime_error("Failed to open trace file (Tracer::dumpToFile)");
+        }
+        dump(file);
+    }
+
+private:
+    struct State {
+        State():
+            epoch(std::chrono::steady_clock::now()),
+            generation(0),
+            nextTid(1)
+        { }
+
+        std::chrono::steady_clock::time_point epoch;
+        std::mutex mutex;
+        std::atomic<unsigned long long> generation;
+        std::vector<std::shared_ptr<TraceBuffer>> buffers;
+        // Buffers of exited threads, handed to new threads before allocating
+        std::vector<TraceBuffer *> retired;
+        unsigned nextTid;
+    };
+
+    // Trivial, so it stays usable while other thread_locals are destroyed
+    struct LocalSlot {
+        TraceBuffer *buffer;
+        bool closed;
+    };
+
+    // Leaves the buffer of the exiting thread to the tracer
+    struct Releaser {
+        void touch() { }
+
+        ~Releaser() {
+            LocalSlot &slot = getLocalSlot();
+            if (slot.buffer) {
+                State &state = getState();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.retired.push_back(slot.buffer);
+            }
+            slot.buffer = nullptr;
+            slot.closed = true;
+        }
+    };
+
+    static std::atomic<bool> &enabledFlag() {
+        static std::atomic<bool> enabled(false);
+        return enabled;
+    }
+
+    // Never destroyed: threads of static pools may still record during exit
+    static State &getState() {
+        static State *state = new State();
+        return *state;
+    }
+
+    static LocalSlot &getLocalSlot() {
+        static thread_local LocalSlot slot = {nullptr, false};
+        return slot;
+    }
+
+    static Releaser &getReleaser() {
+        static thread_local Releaser releaser;
+        return releaser;
+    }
+
+    // Buffers are owned by the tracer and survive their threads with their
+    // events, a new thread takes over one left by an exited thread. Events
+    // recorded during thread exit after that are dropped
+    static TraceBuffer *localBuffer() {
+        LocalSlot &slot = getLocalSlot();
+        if (!slot.buffer && !slot.closed) {
+            getReleaser().touch();
+            State &state = getState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.retired.empty()) {
+                slot.buffer = state.retired.back();
+                state.retired.pop_back();
+            } else {
+                state.buffers.push_back(std::make_shared<TraceBuffer>(state.nextTid++,
+                    state.generation.load(std::memory_order_relaxed)));
+                slot.buffer = state.buffers.back().get();
+            }
+        }
+        return slot.buffer;
+    }
+
+    static void writeString(std::ostream &out, const char *s) {
+        out << '"';
+        for (; *s; ++s) {
+            if (*s == '"' || *s == '\\') {
+                out << '\\';
+            }
+            out << *s;
+        }
+        out << '"';
+    }
+
+    static void writeEvent(std::ostream &out, const TraceEvent &event, unsigned tid) {
+        out << "{\"name\":";
+        writeString(out, event.name);
+        out << ",\"cat\":";
+        writeString(out, event.category);
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+            << ",\"ts\":" << event.begin << ",\"dur\":" << event.duration;
+        if (event.argName) {
+            out << ",\"args\":{";
+            writeString(out, event.argName);
+            out << ":" << event.argValue << "}";
+        }
+        out << "}";
+    }
+};
+
+// Records span from construction to destruction. Names must be string literals
+class TraceSpan {
+public:
+    // Checks the flag only, the span is started by start()
+    TraceSpan():
+        enabled_(Tracer::isEnabled())
+    { }
+
+    TraceSpan(const char *name, const char *category, const char *argName = nullptr,
+              long long argValue = 0):
+        enabled_(Tracer::isEnabled())
+    {
+        if (enabled_) {
+            start(name, category, argName, argValue);
+        }
+    }
+
+    TraceSpan(const TraceSpan &rhs) = delete;
+    TraceSpan &operator= (const TraceSpan &rhs) = delete;
+
+    ~TraceSpan() {
+        if (enabled_) {
+            event_.duration = Tracer::now() - event_.begin;
+            Tracer::record(event_);
+        }
+    }
+
+    bool isEnabled() const { return enabled_; }
+
+    void start(const char *name, const char *category, const char *argName = nullptr,
+               long long argValue = 0) {
+        event_.name = name;
+        event_.category = category;
+        event_.argName = argName;
+        event_.argValue = argValue;
+        event_.begin = Tracer::now();
+    }
+
+private:
+    bool enabled_;
+    TraceEvent event_;
+};
+
+// Span until the end of the enclosing scope. Arguments are evaluated only
+// when tracing is on; with TRACE_DISABLED defined spans compile to nothing
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifndef TRACE_DISABLED
+#define TRACE_SPAN(...) \
+    TraceSpan TRACE_CONCAT(traceSpan_, __LINE__); \
+    if (!TRACE_CONCAT(traceSpan_, __LINE__).isEnabled()) { } \
+    else TRACE_CONCAT(traceSpan_, __LINE__).start(__VA_ARGS__)
+#else
+#define TRACE_SPAN(...) do { } while (false)
+#endif
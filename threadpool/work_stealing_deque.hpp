@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli, "Correct and
+// Efficient Work-Stealing for Weak Memory Models", 2013).
+// Owner thread pushes and pops at the bottom (LIFO), other threads steal from
+// the top (FIFO). T must be trivially copyable (task pointers).
+template <class T>
+class WorkStealingDeque {
+private:
+    class Array {
+    public:
+        Array(int64_t capacity):
+            capacity_(capacity),
+            mask_(capacity - 1),
+            buffer_(new std::atomic<T>[capacity])
+        { }
+
+        ~Array() { delete[] buffer_; }
+
+        int64_t getCapacity() const { return capacity_; }
+
+        T get(int64_t index) const {
+            return buffer_[index & mask_].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t index, T item) {
+            buffer_[index & mask_].store(item, std::memory_order_relaxed);
+        }
+
+        Array *grow(int64_t bottom, int64_t top) const {
+            Array *array = new Array(2 * capacity_);
+            for (int64_t i = top; i != bottom; ++i) {
+                array->put(i, get(i));
+            }
+            return array;
+        }
+
+    private:
+        int64_t capacity_;
+        int64_t mask_;
+        std::atomic<T> *buffer_;
+    };
+
+public:
+    WorkStealingDeque(int64_t capacity = 256):
+        top_(0),
+        bottom_(0),
+        array_(new Array(capacity))
+    { }
+
+    WorkStealingDeque(const WorkStealingDeque &rhs) = delete;
+    WorkStealingDeque &operator= (const WorkStealingDeque &rhs) = delete;
+
+    ~WorkStealingDeque() {
+        delete array_.load(std::memory_order_relaxed);
+        for (Array *array : garbage_) {
+            delete array;
+        }
+    }
+
+    // Owner only
+    void push(T item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array *array = array_.load(std::memory_order_relaxed);
+        if (b - t > array->getCapacity() - 1) {
+            // Thieves may still read the old array, it is freed with the deque
+            garbage_.push_back(array);
+            array = array->grow(b, t);
+            array_.store(array, std::memory_order_release);
+        }
+        array->put(b, item);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only
+    bool pop(T &item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array *array = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = array->get(b);
+        if (t == b) {
+            // Last item, race against thieves
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread. Fails if deque is empty or another thread took the item
+    bool steal(T &item) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        Array *array = array_.load(std::memory_order_acquire);
+        item = array->get(t);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+    size_t size() const {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return (b > t) ? static_cast<size_t>(b - t) : 0;
+    }
+
+private:
+    std::atomic<int64_t> top_;
+    char padding_[64];
+    std::atomic<int64_t> bottom_;
+    std::atomic<Array *> array_;
+    std::vector<Array *> garbage_;
+};